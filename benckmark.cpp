@@ -1,43 +1,385 @@
-#include <C:\Users\Teodor\Desktop\CppProjects\chess\chess.cpp>
+// g++ -std=c++17 -O2 -DNDEBUG -pthread benckmark.cpp -o benchmark  (without NDEBUG every move is checked against a full recompute)
+// benchmark [--samples n] [--filter text] [--json file] [--network file]
+#define CHESS_NO_MAIN
+#include "chess.cpp"
 
 using namespace chess;
 
 namespace benchmark {
 
-}
+	struct CorpusPosition {
+		std::string fen;
+		Position pos;
+		Position uncached;  // only ever copied, so copies start without cached attack maps
+		packed::PackedPosition packedPos;
+	};
+
+	struct Corpus {
+		std::string name;
+		std::vector<CorpusPosition> positions;
+	};
+
+	const std::vector<std::pair<std::string, std::vector<std::string>>> CORPUS_FENS = {
+		{ "opening", {
+			START_FEN,
+			"rnbqkbnr/pp1ppppp/8/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2",
+			"r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+			"rnbqkb1r/pp2pppp/3p1n2/8/3NP3/8/PPP2PPP/RNBQKB1R w KQkq - 1 5",
+			"rnbqkbnr/ppp1pppp/8/3p4/2PP4/8/PP2PPPP/RNBQKBNR b KQkq - 0 2"
+		} },
+		{ "middlegame", {
+			"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+			"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+			"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+			"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+			"r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R w KQ - 0 8"
+		} },
+		{ "endgame", {
+			"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+			"8/8/3pk3/3P4/2K5/8/8/8 b - - 0 1",
+			"8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1",
+			"6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+			"8/5k2/8/8/3B4/8/2N5/4K3 w - - 0 1"
+		} }
+	};
+
+	std::vector<Corpus> loadCorpora() {
+		std::vector<Corpus> corpora;
+		for (const auto& entry : CORPUS_FENS) {
+			Corpus corpus = { entry.first, {} };
+			for (const std::string& fen : entry.second) corpus.positions.push_back({ fen, convert::computePositionFromFen(fen), convert::computePositionFromFen(fen),
+				packed::pack(convert::computePositionFromFen(fen)) });
+			corpora.push_back(corpus);
+		}
+		return corpora;
+	}
+
+	volatile uint64_t sink;  // results go here so the compiler cannot drop the work
 
-void BenckmarkAction(const std::array<chess::SquareId, 64>& board) {
-	chess::pieceMovement::computeLegalMoves_Simple(board, true, -1);
-	chess::pieceMovement::computeLegalMoves_Simple(board, false, -1);	
+	// one pass over a corpus, returns how many operations it did
+	typedef std::function<uint64_t(const Corpus&)> Pass;
+
+	// every piece of the side to move with one of the computePossibleMoves_* functions
+	Pass pieceMovesPass(PieceId piece) {
+		return [piece](const Corpus& corpus) {
+			uint64_t operations = 0, total = 0;
+			MoveList moves;
+			for (const CorpusPosition& p : corpus.positions) {
+				const bitboard::Bitboards& bb = p.pos.bitboards;
+				const bool color = p.pos.activeColor;
+				bitboard::Bitboard pieces = bb.getPieces(piece, color);
+				while (pieces) {
+					const int8_t pos = bitboard::popLsb(pieces);
+					moves.clear();
+					switch (piece) {
+						case pawn:
+							if (color) pieceMovement::computePossibleMoves_Pawn<true>(bb, pos, p.pos.enPassantTarget, moves);
+							else pieceMovement::computePossibleMoves_Pawn<false>(bb, pos, p.pos.enPassantTarget, moves);
+							break;
+						case knight: pieceMovement::computePossibleMoves_Knight(bb, pos, color, moves); break;
+						case bishop: pieceMovement::computePossibleMoves_Bishop(bb, pos, color, moves); break;
+						case rook: pieceMovement::computePossibleMoves_Rook(bb, pos, color, moves); break;
+						case queen: pieceMovement::computePossibleMoves_Queen(bb, pos, color, moves); break;
+						case king: pieceMovement::computePossibleMoves_King_Simple(bb, pos, color, moves); break;
+					}
+					total += moves.size();
+					operations++;
+				}
+			}
+			sink = sink + total;
+			return operations;
+		};
+	}
+
+	const std::vector<std::pair<std::string, Pass>> BENCHMARKS = {
+		{ "computeLegalMoves", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			MoveList moves;
+			for (const CorpusPosition& p : corpus.positions) {
+				moves.clear();
+				p.pos.computeLegalMoves(moves);
+				total += moves.size();
+			}
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "movePicker", [](const Corpus& corpus) {  // every move of the position, hash move and killers unknown
+			uint64_t total = 0;
+			search::HistoryTable history;
+			const Move killers[2] = { NULL_MOVE, NULL_MOVE };
+			for (const CorpusPosition& p : corpus.positions) {
+				search::MovePicker picker(p.pos, NULL_MOVE, killers, history);
+				while (Move move = picker.next()) total += move;
+			}
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "computeSee", [](const Corpus& corpus) {  // every capture of the side to move
+			uint64_t total = 0, operations = 0;
+			MoveList moves;
+			for (const CorpusPosition& p : corpus.positions) {
+				moves.clear();
+				p.pos.computeLegalMoves<pieceMovement::captureMoves>(moves);
+				for (Move move : moves) total += evaluation::computeSee(p.pos, move);
+				operations += moves.size();
+			}
+			sink = sink + total;
+			return operations;
+		} },
+		{ "computePossibleMoves_Pawn", pieceMovesPass(pawn) },
+		{ "computePossibleMoves_Knight", pieceMovesPass(knight) },
+		{ "computePossibleMoves_Bishop", pieceMovesPass(bishop) },
+		{ "computePossibleMoves_Rook", pieceMovesPass(rook) },
+		{ "computePossibleMoves_Queen", pieceMovesPass(queen) },
+		{ "computePossibleMoves_King_Simple", pieceMovesPass(king) },
+		{ "isSquareAttacked", [](const Corpus& corpus) {  // every square, for the side to move
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				for (int8_t pos = 0; pos < 64; pos++) total += pieceMovement::isSquareAttacked(p.pos.bitboards, p.pos.activeColor, pos);
+			}
+			sink = sink + total;
+			return uint64_t(64 * corpus.positions.size());
+		} },
+		{ "findKing", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				total += pieceMovement::findKing(p.pos.bitboards, true) + pieceMovement::findKing(p.pos.bitboards, false);
+			}
+			sink = sink + total;
+			return uint64_t(2 * corpus.positions.size());
+		} },
+		{ "findKing_Board", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				total += pieceMovement::findKing(p.pos.board, true) + pieceMovement::findKing(p.pos.board, false);
+			}
+			sink = sink + total;
+			return uint64_t(2 * corpus.positions.size());
+		} },
+		{ "parseFen", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			convert::FenFields fields;
+			for (const CorpusPosition& p : corpus.positions) {
+				convert::parseFen(p.fen, fields);
+				total += fields.board[0];
+			}
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "computeFenPartFromBoard", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) total += convert::computeFenPartFromBoard(p.pos.board).size();
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "pack", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) total += packed::pack(p.pos).pieces[0];
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "unpackBitboards", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			bitboard::Bitboards bb;
+			for (const CorpusPosition& p : corpus.positions) {
+				packed::unpackBitboards(p.packedPos, bb);
+				total += bb.pieces[wking];
+			}
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "unpack", [](const Corpus& corpus) {  // a full Position, keys and scores included
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) total += packed::unpack(p.packedPos).key;
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "computeSymmetry_Board", [](const Corpus& corpus) {  // all 8 symmetries
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				for (int8_t s = 0; s < 8; s++) total += symmetry::computeSymmetry(symmetry::SymmetryId(s), p.pos.board)[s];
+			}
+			sink = sink + total;
+			return uint64_t(8 * corpus.positions.size());
+		} },
+		{ "computeSymmetry_Bitboard", [](const Corpus& corpus) {  // all 8 symmetries of the occupancy
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				for (int8_t s = 0; s < 8; s++) total += symmetry::computeSymmetry(symmetry::SymmetryId(s), p.pos.bitboards.occupied);
+			}
+			sink = sink + total;
+			return uint64_t(8 * corpus.positions.size());
+		} },
+		{ "evaluate", [](const Corpus& corpus) {  // attack maps included, a new search node does not have them yet either
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				Position pos = p.uncached;
+				total += evaluation::evaluate(pos);
+			}
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "evaluatePawns", [](const Corpus& corpus) {  // without the pawn table, evaluate finds these in it
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) total += evaluation::evaluatePawns(p.pos.bitboards).mg;
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "makeMove", [](const Corpus& corpus) {  // make and unmake of every legal move, incremental keys and scores included
+			uint64_t total = 0, operations = 0;
+			MoveList moves;
+			for (const CorpusPosition& p : corpus.positions) {
+				Position pos = p.pos;
+				moves.clear();
+				pos.computeLegalMoves(moves);
+				for (Move move : moves) {
+					UndoInfo undo = pos.makeMove(move);
+					total += pos.pieceSquareScore.mg;
+					pos.unmakeMove(move, undo);
+				}
+				operations += moves.size();
+			}
+			sink = sink + total;
+			return operations;
+		} },
+		{ "computeCanonicalForm", [](const Corpus& corpus) {
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) total += symmetry::computeCanonicalForm(p.pos).key;
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} },
+		{ "perft2", [](const Corpus& corpus) {  // make/unmake and bulk counting together
+			uint64_t total = 0;
+			for (const CorpusPosition& p : corpus.positions) {
+				Position pos = p.pos.copy();
+				total += perft::perft(pos, 2);
+			}
+			sink = sink + total;
+			return uint64_t(corpus.positions.size());
+		} }
+	};
+
+	struct Options {
+		u_int samples = 50;
+		double warmupMs = 50;
+		double sampleMs = 2;  // passes per sample grow until a sample takes this long
+		std::string filter;
+		std::string jsonPath;
+		std::string networkPath;  // evaluate with this nnue network instead of the classical evaluation
+	};
+
+	struct Result {
+		std::string name;
+		std::string corpus;
+		uint64_t operationsPerSample;
+		std::vector<double> samples;  // ns per operation, sorted
+		double median, p99, min, mean;
+	};
+
+	double elapsedNs(std::chrono::high_resolution_clock::time_point begin) {
+		return double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - begin).count());
+	}
+
+	Result run(const std::string& name, const Pass& pass, const Corpus& corpus, const Options& options) {
+		// warmup, also finds how many passes make one sample long enough to time
+		u_int passes = 1;
+		uint64_t operations = 0;
+		auto warmupBegin = std::chrono::high_resolution_clock::now();
+		while (true) {
+			auto begin = std::chrono::high_resolution_clock::now();
+			operations = 0;
+			for (u_int i = 0; i < passes; i++) operations += pass(corpus);
+			if (elapsedNs(begin) < options.sampleMs * 1e6) passes *= 2;
+			else if (elapsedNs(warmupBegin) >= options.warmupMs * 1e6) break;
+		}
+		if (!operations) throw "benchmark did nothing on this corpus";
+
+		Result result = { name, corpus.name, operations, {}, 0, 0, 0, 0 };
+		for (u_int s = 0; s < options.samples; s++) {
+			auto begin = std::chrono::high_resolution_clock::now();
+			for (u_int i = 0; i < passes; i++) pass(corpus);
+			result.samples.push_back(elapsedNs(begin) / operations);
+		}
+		std::sort(result.samples.begin(), result.samples.end());
+		const size_t n = result.samples.size();
+		result.median = n % 2 ? result.samples[n / 2] : (result.samples[n / 2 - 1] + result.samples[n / 2]) / 2;
+		result.p99 = result.samples[(99 * n + 99) / 100 - 1];  // nearest rank
+		result.min = result.samples[0];
+		for (double sample : result.samples) result.mean += sample / n;
+		return result;
+	}
+
+	std::string computeResultsToJson(const std::vector<Result>& results, const Options& options) {
+		std::ostringstream out;
+		out.precision(2);
+		out << std::fixed;
+		out << "{\n";
+#ifdef __VERSION__
+		out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+#ifdef NDEBUG
+		out << "  \"debug_checks\": false,\n";
+#else
+		out << "  \"debug_checks\": true,\n";
+#endif
+#ifdef __BMI2__
+		out << "  \"bmi2\": true,\n";
+#else
+		out << "  \"bmi2\": false,\n";
+#endif
+		out << "  \"network\": \"" << options.networkPath << "\",\n";
+		out << "  \"nnue_kernels\": \"" << nnue::kernels::active.name << "\",\n";
+		out << "  \"samples\": " << options.samples << ",\n";
+		out << "  \"unit\": \"ns per operation\",\n";
+		out << "  \"results\": [\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const Result& r = results[i];
+			out << "    { \"name\": \"" << r.name << "\", \"corpus\": \"" << r.corpus << "\", \"operations\": " << r.operationsPerSample
+				<< ", \"median\": " << r.median << ", \"p99\": " << r.p99 << ", \"min\": " << r.min << ", \"mean\": " << r.mean << ", \"per_second\": " << 1e9 / r.median << " }"
+				<< (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+		return out.str();
+	}
+
+	Options parseOptions(int argc, char const *argv[]) {
+		Options options;
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (i + 1 >= argc) throw "missing option value";
+			if (arg == "--samples") options.samples = std::max(1, std::stoi(argv[++i]));
+			else if (arg == "--filter") options.filter = argv[++i];
+			else if (arg == "--json") options.jsonPath = argv[++i];
+			else if (arg == "--network") options.networkPath = argv[++i];
+			else throw "unknown option";
+		}
+		return options;
+	}
 }
 
-int main(int argc, char const *argv[])
-{
-	
-	// CHANGE THIS
-	// std::array<chess::SquareId, 64> testBoard = chess::convert::computeBoardFromFenPart("rnb1kbnr/ppp1pppp/8/1B1q4/8/8/PPPP1PPP/RNBQK1NR");
-	// std::array<chess::SquareId, 64> testBoard = chess::convert::computeBoardFromFenPart("rnbqkbnr/ppp1pppp/8/3P4/B7/5P2/PPPP2PP/RNBQK1NR");
-	std::array<chess::SquareId, 64> testBoard = chess::convert::computeBoardFromFenPart("8/8/3pk3/3P4/2K5/8/8/8");
-	// std::array<chess::SquareId, 64> testBoard = chess::convert::computeBoardFromFenPart(chess::DEFAULT_FEN);
-	u_int TEST_TIMES = 33333;
-	#define FUNCTION BenckmarkAction(testBoard)
-	// CHANGE THIS
-
-
-	
-	auto begin = std::chrono::high_resolution_clock::now();
-	for (u_int i = 1; i < TEST_TIMES; i++) {
-		FUNCTION;
-		if (i % (TEST_TIMES / 100) == 0) {
-			auto timeDiff = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-begin).count();
-			std::cout << i / (TEST_TIMES / 100) << "% | Avg time: " << timeDiff / i 
-				<< "ns | Time Remaining: " << ((100 - (i / (TEST_TIMES / 100))) * (100 * timeDiff / (i / (TEST_TIMES / 100)))) / 100000000000 << "s" << std::endl;
+int main(int argc, char const *argv[]) {
+	try {
+		benchmark::Options options = benchmark::parseOptions(argc, argv);
+		if (!options.networkPath.empty()) nnue::load(options.networkPath);
+		std::vector<benchmark::Corpus> corpora = benchmark::loadCorpora();
+		std::vector<benchmark::Result> results;
+		std::printf("%-34s %-11s %12s %12s %12s %14s\n", "benchmark", "corpus", "median ns", "p99 ns", "min ns", "per second");
+		for (const auto& b : benchmark::BENCHMARKS) {
+			if (!options.filter.empty() && b.first.find(options.filter) == std::string::npos) continue;
+			for (const benchmark::Corpus& corpus : corpora) {
+				benchmark::Result r = benchmark::run(b.first, b.second, corpus, options);
+				std::printf("%-34s %-11s %12.2f %12.2f %12.2f %14.0f\n", r.name.c_str(), r.corpus.c_str(), r.median, r.p99, r.min, 1e9 / r.median);
+				results.push_back(r);
+			}
+		}
+		if (!options.jsonPath.empty()) {
+			std::ofstream out(options.jsonPath);
+			out << benchmark::computeResultsToJson(results, options);
+			if (!out) throw "cannot write json file";
 		}
+	} catch (const char* s) {
+		std::cerr << "ERROR: " << s << std::endl;
+		return 1;
 	}
-	auto end = std::chrono::high_resolution_clock::now();
-	auto diff = std::chrono::duration_cast<std::chrono::nanoseconds>(end-begin).count();
-	std::cout << diff / TEST_TIMES << "ns/step | Total: " << diff / 1000000 << "ms" << std::endl;
 	return 0;
 }
-
-// computeLegalMoves_Simple : 161810ns
\ No newline at end of file
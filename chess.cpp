@@ -1,12 +1,46 @@
 #include <iostream>
 #include <ostream>
 #include <algorithm>
+#include <array>
+#include <string>
 #include <map>
 #include <memory>
 #include <cstdlib>
 #include <vector>
 #include <cstdint>
 #include <chrono>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <string_view>
+#include <charconv>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cctype>
+#include <deque>
+#if defined(__BMI2__) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#include <immintrin.h>  // pext, and the simd kernels of nnue which are compiled for their own target
+#endif
+#if defined(CHESS_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#elif defined(CHESS_STATS) && defined(_M_X64)
+#include <intrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // no such flag on macos, a write to a closed socket raises SIGPIPE there
+#endif
+#endif
 
 typedef unsigned int u_int;
 typedef unsigned char u_char;
@@ -14,6 +48,8 @@ typedef unsigned char u_char;
 namespace chess {
 
 	const std::string DEFAULT_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR";
+	const std::string START_FEN = DEFAULT_FEN + " w KQkq - 0 1";
+	const int MAX_HALFMOVE_CLOCK = 150;  // plies, the 75 move rule ends the game there
 
 	enum PieceId { pawn, knight, bishop, rook, queen, king };
 	const std::string PieceNames[] = { "pawn", "knight", "bishop", "rook", "queen", "king" };
@@ -29,204 +65,665 @@ namespace chess {
 		return piece % 2;
 	}
 
-	namespace pieceMovement {
-		// not necessarly legal movement
+	PieceId getPieceId(SquareId piece) {
+		if (piece == empty) throw "empty square has no piece id";
+		return PieceId((piece - 1) / 2);
+	}
 
-		std::vector<int8_t> computePossibleMoves_WhitePawn_NoEnPassant(const std::array<SquareId, 64>& board, int8_t pos) {  // ordered
-			std::vector<int8_t> res;
-			if (pos >= 48 && pos <= 55 && board[pos - 8] == empty && board[pos - 16] == empty) res.push_back(pos - 16);
-			if (pos % 8 != 0 && board[pos - 9] != empty && !getPieceColor(board[pos - 9])) res.push_back(pos - 9);
-			if (board[pos - 8] == empty) res.push_back(pos - 8);
-			if (pos % 8 != 7 && board[pos - 7] != empty && !getPieceColor(board[pos - 7])) res.push_back(pos - 7);
-			return res;
+	SquareId getSquareId(PieceId piece, bool color) {
+		return SquareId(2 * piece + (color ? 1 : 2));
+	}
+
+	// hot path counters: calls and cycles of each stage, compiled in only with -DCHESS_STATS
+	// every thread counts into its own block without locks, blocks are summed when the counters are read
+	namespace stats {
+
+		enum Counter { moveGeneration, legalityFiltering, attackChecks, boardCopies, evaluations,
+			ttProbes, ttHits, canonicalProbes, canonicalHits, tablebaseProbes, tablebaseHits, pawnProbes, pawnHits, COUNTER_COUNT };
+		const std::string CounterNames[] = { "moveGeneration", "legalityFiltering", "attackChecks", "boardCopies", "evaluations",
+			"ttProbes", "ttHits", "canonicalProbes", "canonicalHits", "tablebaseProbes", "tablebaseHits", "pawnProbes", "pawnHits" };
+
+		struct Counters {
+			uint64_t calls[COUNTER_COUNT] = {};
+			uint64_t cycles[COUNTER_COUNT] = {};  // inclusive: a stage nested in another one counts in both, hits are not timed
+
+			Counters& operator+=(const Counters& other) {
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					calls[i] += other.calls[i];
+					cycles[i] += other.cycles[i];
+				}
+				return *this;
+			}
+		};
+
+		struct Snapshot {
+			std::vector<Counters> threads;  // threads still running, in start order
+			Counters finished;  // threads that already exited
+			Counters total;
+		};
+
+#ifdef CHESS_STATS
+		const bool ENABLED = true;
+
+		inline uint64_t readCycles() {  // time stamp counter, nanoseconds where there is none
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+			return __rdtsc();
+#else
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+		}
+
+		struct ThreadBlock {  // only its own thread writes, so a relaxed load and store is enough
+			std::atomic<uint64_t> calls[COUNTER_COUNT] = {};
+			std::atomic<uint64_t> cycles[COUNTER_COUNT] = {};
+
+			Counters read() const {
+				Counters c;
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					c.calls[i] = calls[i].load(std::memory_order_relaxed);
+					c.cycles[i] = cycles[i].load(std::memory_order_relaxed);
+				}
+				return c;
+			}
+
+			void clear() {
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					calls[i].store(0, std::memory_order_relaxed);
+					cycles[i].store(0, std::memory_order_relaxed);
+				}
+			}
+		};
+
+		std::mutex registryMutex;
+		std::vector<ThreadBlock*> registry;
+		Counters finished;
+
+		// registers the block of a thread, its counts move into finished when the thread exits
+		struct ThreadRegistration {
+			ThreadBlock block;
+
+			ThreadRegistration() {
+				std::lock_guard<std::mutex> lock(registryMutex);
+				registry.push_back(&block);
+			}
+
+			~ThreadRegistration() {
+				std::lock_guard<std::mutex> lock(registryMutex);
+				finished += block.read();
+				registry.erase(std::find(registry.begin(), registry.end(), &block));
+			}
+		};
+
+		inline ThreadBlock& getThreadBlock() {
+			thread_local ThreadRegistration registration;
+			return registration.block;
+		}
+
+		inline void add(Counter counter, uint64_t cycles) {
+			ThreadBlock& block = getThreadBlock();
+			block.calls[counter].store(block.calls[counter].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			block.cycles[counter].store(block.cycles[counter].load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+		}
+
+		class Timer {  // counts one call and the cycles until the end of the scope
+			private:
+				Counter counter;
+				uint64_t begin;
+
+			public:
+				explicit Timer(Counter counter) : counter(counter), begin(readCycles()) {
+
+				}
+
+				~Timer() {
+					add(counter, readCycles() - begin);
+				}
+		};
+
+		Snapshot collect() {
+			std::lock_guard<std::mutex> lock(registryMutex);
+			Snapshot snapshot;
+			snapshot.finished = finished;
+			snapshot.total = finished;
+			for (const ThreadBlock* block : registry) {
+				snapshot.threads.push_back(block->read());
+				snapshot.total += snapshot.threads.back();
+			}
+			return snapshot;
+		}
+
+		void reset() {  // between commands or searches, a thread counting at the same time may keep a few counts
+			std::lock_guard<std::mutex> lock(registryMutex);
+			finished = Counters();
+			for (ThreadBlock* block : registry) block->clear();
+		}
+
+#define CHESS_STATS_TIME(counter) chess::stats::Timer chessStatsTimer(chess::stats::counter)
+#define CHESS_STATS_COUNT(counter) chess::stats::add(chess::stats::counter, 0)
+#else
+		const bool ENABLED = false;
+
+		Snapshot collect() {
+			return Snapshot();
+		}
+
+		void reset() {
+
+		}
+
+#define CHESS_STATS_TIME(counter)
+#define CHESS_STATS_COUNT(counter)
+#endif
+
+		std::string computeStatsToText(const Snapshot& snapshot) {
+			std::ostringstream out;
+			auto print = [&](const std::string& title, const Counters& c) {
+				out << title << std::endl;
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					if (!c.calls[i]) continue;
+					out << "  " << CounterNames[i] << ": " << c.calls[i] << " calls";
+					if (c.cycles[i]) out << " | " << c.cycles[i] << " cycles | " << c.cycles[i] / c.calls[i] << " cycles/call";
+					out << std::endl;
+				}
+			};
+			print("total", snapshot.total);
+			for (size_t i = 0; i < snapshot.threads.size(); i++) print("thread " + std::to_string(i), snapshot.threads[i]);
+			print("finished threads", snapshot.finished);
+			return out.str();
+		}
+
+		std::string computeStatsToJson(const Snapshot& snapshot) {
+			auto toJson = [](const Counters& c) {
+				std::string s = "{";
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					s += std::string(i ? ", " : "") + "\"" + CounterNames[i] + "\": { \"calls\": " + std::to_string(c.calls[i])
+						+ ", \"cycles\": " + std::to_string(c.cycles[i]) + " }";
+				}
+				return s + "}";
+			};
+			std::string s = "{\"total\": " + toJson(snapshot.total) + ", \"threads\": [";
+			for (size_t i = 0; i < snapshot.threads.size(); i++) s += (i ? ", " : "") + toJson(snapshot.threads[i]);
+			return s + "], \"finished\": " + toJson(snapshot.finished) + "}\n";
+		}
+	}
+
+	namespace bitboard {
+		// bit i is square i (a8 = bit 0, h1 = bit 63), same layout as the board array
+
+		typedef uint64_t Bitboard;
+
+		const Bitboard COLUMN_A = 0x0101010101010101ULL;
+		const Bitboard COLUMN_H = COLUMN_A << 7;
+		const Bitboard ROW_8 = 0xFFULL;
+		const Bitboard ROW_1 = ROW_8 << 56;
+
+		constexpr Bitboard EDGE_SQUARES = ROW_8 | ROW_1 | COLUMN_A | COLUMN_H;
+		constexpr Bitboard CORNER_SQUARES = (ROW_8 | ROW_1) & (COLUMN_A | COLUMN_H);
+
+		constexpr Bitboard squareBit(int8_t pos) {
+			return Bitboard(1) << pos;
+		}
+
+		constexpr int8_t getColumn(int8_t pos) {  // 0 = column a
+			return pos & 7;
 		}
 
-		std::vector<int8_t> computePossibleMoves_BlackPawn_NoEnPassant(const std::array<SquareId, 64>& board, int8_t pos) {  // ordered
-			std::vector<int8_t> res;
-			if (pos % 8 != 0 && board[pos + 7] != empty && getPieceColor(board[pos + 7])) res.push_back(pos + 7);
-			if (board[pos + 8] == empty) res.push_back(pos + 8);
-			if (pos % 8 != 7 && board[pos + 9] != empty && getPieceColor(board[pos + 9])) res.push_back(pos + 9);
-			if (pos >= 8 && pos <= 15 && board[pos + 8] == empty && board[pos + 16] == empty) res.push_back(pos + 16);
+		constexpr int8_t getRow(int8_t pos) {  // 0 = row 8
+			return pos >> 3;
+		}
+
+		inline int8_t popCount(Bitboard b) {
+			return __builtin_popcountll(b);
+		}
+
+		inline int8_t getLsb(Bitboard b) {  // b must not be 0
+			return __builtin_ctzll(b);
+		}
+
+		inline int8_t popLsb(Bitboard& b) {
+			int8_t pos = getLsb(b);
+			b &= b - 1;
+			return pos;
+		}
+
+		// geometry tables, built by the compiler (no startup cost and no division at runtime)
+
+		typedef std::array<Bitboard, 64> SquareTable;
+		typedef std::array<std::array<Bitboard, 64>, 64> SquarePairTable;
+
+		constexpr int8_t knightSteps[8][2] = { { -1, -2 }, { 1, -2 }, { -2, -1 }, { 2, -1 }, { -2, 1 }, { 2, 1 }, { -1, 2 }, { 1, 2 } };  // { dx, dy }
+		constexpr int8_t kingSteps[8][2] = { { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 }, { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };  // also the ray directions
+		constexpr int8_t whitePawnSteps[2][2] = { { -1, -1 }, { 1, -1 } };
+		constexpr int8_t blackPawnSteps[2][2] = { { -1, 1 }, { 1, 1 } };
+
+		constexpr bool isOnBoard(int x, int y) {
+			return x >= 0 && x < 8 && y >= 0 && y < 8;
+		}
+
+		template <size_t COUNT>
+		constexpr SquareTable computeStepTable(const int8_t (&steps)[COUNT][2]) {
+			SquareTable res = {};
+			for (int8_t pos = 0; pos < 64; pos++) {
+				for (size_t i = 0; i < COUNT; i++) {
+					int x = getColumn(pos) + steps[i][0], y = getRow(pos) + steps[i][1];
+					if (isOnBoard(x, y)) res[pos] |= squareBit(8 * y + x);
+				}
+			}
 			return res;
 		}
 
-		std::vector<int8_t> computePossibleMoves_WhitePawn_WithEnPassant(const std::array<SquareId, 64>& board, int8_t pos, int8_t enPassantTarget) {  // ordered
-			std::vector<int8_t> res;
-			if (pos >= 48 && pos <= 55 && board[pos - 8] == empty && board[pos - 16] == empty) res.push_back(pos - 16);
-			if (enPassantTarget == pos - 9 || (pos % 8 != 0 && board[pos - 9] != empty && !getPieceColor(board[pos - 9]))) res.push_back(pos - 9);
-			if (board[pos - 8] == empty) res.push_back(pos - 8);
-			if (enPassantTarget == pos - 7 || (pos % 8 != 7 && board[pos - 7] != empty && !getPieceColor(board[pos - 7]))) res.push_back(pos - 7);
+		constexpr Bitboard computeRay(int8_t pos, int dx, int dy) {  // empty board, pos itself excluded
+			Bitboard res = 0;
+			for (int x = getColumn(pos) + dx, y = getRow(pos) + dy; isOnBoard(x, y); x += dx, y += dy) res |= squareBit(8 * y + x);
 			return res;
 		}
 
-		std::vector<int8_t> computePossibleMoves_BlackPawn_WithEnPassant(const std::array<SquareId, 64>& board, int8_t pos, int8_t enPassantTarget) {  // ordered
-			std::vector<int8_t> res;
-			if (enPassantTarget == pos + 7 || (pos % 8 != 0 && board[pos + 7] != empty && getPieceColor(board[pos + 7]))) res.push_back(pos + 7);
-			if (board[pos + 8] == empty) res.push_back(pos + 8);
-			if (enPassantTarget == pos + 9 || (pos % 8 != 7 && board[pos + 9] != empty && getPieceColor(board[pos + 9]))) res.push_back(pos + 9);
-			if (pos >= 8 && pos <= 15 && board[pos + 8] == empty && board[pos + 16] == empty) res.push_back(pos + 16);
+		constexpr std::array<SquareTable, 8> computeRayTable() {
+			std::array<SquareTable, 8> res = {};
+			for (int8_t d = 0; d < 8; d++) {
+				for (int8_t pos = 0; pos < 64; pos++) res[d][pos] = computeRay(pos, kingSteps[d][0], kingSteps[d][1]);
+			}
 			return res;
 		}
 
-		std::vector<int8_t> computePossibleMoves_Knight(const std::array<SquareId, 64>& board, int8_t pos, bool color) {  // ordered
-			div_t d = std::div(pos, 8);
-			int8_t x = d.rem;
-			int8_t y = d.quot;
-			std::vector<int8_t> res;
-			if (x > 0 && y > 1 && (board[pos - 17] == empty || color != getPieceColor(board[pos - 17]))) res.push_back(pos - 17);
-			if (x < 7 && y > 1 && (board[pos - 15] == empty || color != getPieceColor(board[pos - 15]))) res.push_back(pos - 15);
-			if (x > 1 && y > 0 && (board[pos - 10] == empty || color != getPieceColor(board[pos - 10]))) res.push_back(pos - 10);
-			if (x < 6 && y > 0 && (board[pos -  6] == empty || color != getPieceColor(board[pos -  6]))) res.push_back(pos -  6);
-			if (x > 1 && y < 7 && (board[pos +  6] == empty || color != getPieceColor(board[pos +  6]))) res.push_back(pos +  6);
-			if (x < 6 && y < 7 && (board[pos + 10] == empty || color != getPieceColor(board[pos + 10]))) res.push_back(pos + 10);
-			if (x > 0 && y < 6 && (board[pos + 15] == empty || color != getPieceColor(board[pos + 15]))) res.push_back(pos + 15);
-			if (x < 7 && y < 6 && (board[pos + 17] == empty || color != getPieceColor(board[pos + 17]))) res.push_back(pos + 17);
+		constexpr SquareTable computeSliderRayTable(bool diagonal) {  // empty board bishop or rook attacks
+			SquareTable res = {};
+			for (int8_t d = 0; d < 8; d++) {
+				if ((kingSteps[d][0] && kingSteps[d][1]) != diagonal) continue;
+				for (int8_t pos = 0; pos < 64; pos++) res[pos] |= computeRay(pos, kingSteps[d][0], kingSteps[d][1]);
+			}
 			return res;
 		}
 
-		std::vector<int8_t> computePossibleMoves_Bishop(const std::array<SquareId, 64>& board, int8_t pos, bool color) {  // NOT ordered
-			div_t d = std::div(pos, 8);
-			int8_t x = d.rem;
-			int8_t y = d.quot;
-			std::vector<int8_t> res;
-			for (int8_t i = pos - 7; i >= pos - 7 * std::min<int8_t>(7 - x, y); i -= 7) {  // up-right
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+		// between: squares strictly between two aligned squares, line: the full line through both, 0 if not aligned
+		constexpr SquarePairTable computeLineTable(bool between) {
+			SquarePairTable res = {};
+			for (int8_t a = 0; a < 64; a++) {
+				for (int8_t d = 0; d < 8; d++) {
+					const int dx = kingSteps[d][0], dy = kingSteps[d][1];
+					const Bitboard line = computeRay(a, dx, dy) | computeRay(a, -dx, -dy) | squareBit(a);
+					Bitboard passed = 0;
+					for (int x = getColumn(a) + dx, y = getRow(a) + dy; isOnBoard(x, y); x += dx, y += dy) {
+						res[a][8 * y + x] = between ? passed : line;
+						passed |= squareBit(8 * y + x);
+					}
+				}
 			}
-			for (int8_t i = pos + 9; i <= pos + 9 * std::min<int8_t>(7 - x, 7 - y); i += 9) {  // down-right
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+			return res;
+		}
+
+		constexpr std::array<std::array<int8_t, 64>, 64> computeDistanceTable(bool chebyshev) {
+			std::array<std::array<int8_t, 64>, 64> res = {};
+			for (int8_t a = 0; a < 64; a++) {
+				for (int8_t b = 0; b < 64; b++) {
+					int dx = getColumn(a) - getColumn(b), dy = getRow(a) - getRow(b);
+					dx = dx < 0 ? -dx : dx;
+					dy = dy < 0 ? -dy : dy;
+					res[a][b] = chebyshev ? (dx > dy ? dx : dy) : dx + dy;
+				}
 			}
-			for (int8_t i = pos + 7; i <= pos + 7 * std::min<int8_t>(x, 7 - y); i += 7) {  // down-left
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+			return res;
+		}
+
+		constexpr SquareTable knightAttacks = computeStepTable(knightSteps);
+		constexpr SquareTable kingAttacks = computeStepTable(kingSteps);
+		constexpr std::array<SquareTable, 2> pawnAttacks = { computeStepTable(blackPawnSteps), computeStepTable(whitePawnSteps) };  // [color][pos]
+		constexpr std::array<SquareTable, 8> rays = computeRayTable();  // [direction][pos], directions as in kingSteps
+		constexpr SquareTable bishopRays = computeSliderRayTable(true);
+		constexpr SquareTable rookRays = computeSliderRayTable(false);
+		constexpr SquarePairTable betweenSquares = computeLineTable(true);
+		constexpr SquarePairTable lineSquares = computeLineTable(false);
+		constexpr std::array<std::array<int8_t, 64>, 64> chebyshevDistance = computeDistanceTable(true);  // king moves
+		constexpr std::array<std::array<int8_t, 64>, 64> manhattanDistance = computeDistanceTable(false);
+
+		struct Magic {
+			Bitboard mask;  // relevant occupancy, board edges excluded
+			Bitboard magic;
+			Bitboard* attacks;
+			u_int shift;
+
+			u_int index(Bitboard occupied) const {
+#ifdef __BMI2__
+				return u_int(_pext_u64(occupied, mask));
+#else
+				return u_int(((occupied & mask) * magic) >> shift);
+#endif
 			}
-			for (int8_t i = pos - 9; i >= pos - 9 * std::min<int8_t>(x, y); i -= 9) {  // up-left
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+		};
+
+		Magic rookMagics[64];
+		Magic bishopMagics[64];
+		Bitboard rookTable[0x19000];  // 102400 = sum of 2^bits over all rook masks
+		Bitboard bishopTable[0x1480];  // 5248
+
+		const int8_t rookDirections[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };  // { dx, dy }
+		const int8_t bishopDirections[4][2] = { { 1, -1 }, { 1, 1 }, { -1, 1 }, { -1, -1 } };
+
+		inline Bitboard bishopAttacks(int8_t pos, Bitboard occupied) {
+			const Magic& m = bishopMagics[pos];
+			return m.attacks[m.index(occupied)];
+		}
+
+		inline Bitboard rookAttacks(int8_t pos, Bitboard occupied) {
+			const Magic& m = rookMagics[pos];
+			return m.attacks[m.index(occupied)];
+		}
+
+		inline Bitboard queenAttacks(int8_t pos, Bitboard occupied) {
+			return bishopAttacks(pos, occupied) | rookAttacks(pos, occupied);
+		}
+
+		Bitboard computeSlidingAttacks(int8_t pos, Bitboard occupied, const int8_t directions[4][2]) {  // slow, init only
+			Bitboard res = 0;
+			for (int8_t d = 0; d < 4; d++) {
+				int8_t x = getColumn(pos) + directions[d][0];
+				int8_t y = getRow(pos) + directions[d][1];
+				while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+					res |= squareBit(8 * y + x);
+					if (occupied & squareBit(8 * y + x)) break;
+					x += directions[d][0];
+					y += directions[d][1];
+				}
 			}
 			return res;
 		}
 
-		std::vector<int8_t> computePossibleMoves_Rook(const std::array<SquareId, 64>& board, int8_t pos, bool color) {  // ordered
-			int8_t y = pos / 8;
-			std::vector<int8_t> res;
-			for (int8_t i = pos - 1; i >= 8 * y; i--) {  // left
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+		// found offline with a sparse random search, any magic that maps every occupancy subset without collision works
+		const Bitboard rookMagicNumbers[64] = {
+			0x0480046281400010ULL, 0x80C0200010004000ULL, 0x8780200008300180ULL, 0x8880060800100080ULL,
+			0x2100030010080084ULL, 0x0100040001000802ULL, 0x0200040800810200ULL, 0x0580008002407100ULL,
+			0x1000800080400020ULL, 0x0080401000402001ULL, 0x800C802002100880ULL, 0x800A002200884010ULL,
+			0x2046002008108600ULL, 0x0222009002000804ULL, 0x100B000421001200ULL, 0x0240800100004080ULL,
+			0x4540008020408006ULL, 0x8010054020084002ULL, 0x7D10010100200040ULL, 0x1408008010000882ULL,
+			0x4408010005000810ULL, 0x001E008004000280ULL, 0x0230040001080210ULL, 0x0000020004004081ULL,
+			0x0100400080208001ULL, 0x1000842300400100ULL, 0x1060100080200082ULL, 0x3219004B00100020ULL,
+			0x9010080080800400ULL, 0x8440020080800400ULL, 0x6008010080800200ULL, 0x4123008200010044ULL,
+			0x0280002001400240ULL, 0x0220100040400020ULL, 0x0060801003802008ULL, 0x0008100080800800ULL,
+			0x0105000801001004ULL, 0x100B000803000400ULL, 0x0000024814001021ULL, 0x00408000C2802100ULL,
+			0x4C40004020808002ULL, 0x4410500420024000ULL, 0x00C0100020008080ULL, 0x0000100008008080ULL,
+			0x8002000804220011ULL, 0x0802000804010100ULL, 0x0243100201040008ULL, 0x0000009100420014ULL,
+			0x1000400280022480ULL, 0x0020200040100040ULL, 0x00A000100800C140ULL, 0x0410001408008080ULL,
+			0x0000080004008080ULL, 0x0100020004008080ULL, 0x0303000200040300ULL, 0x1480006104008200ULL,
+			0x00008002204A1101ULL, 0x1040090010224081ULL, 0x4300C0200011000DULL, 0x8002041001002009ULL,
+			0x2005000800020411ULL, 0x110A008408100102ULL, 0x0006000108008402ULL, 0x0200002900884402ULL
+		};
+
+		const Bitboard bishopMagicNumbers[64] = {
+			0x48081010008A2A80ULL, 0x000948110C0B2081ULL, 0x0944140400500000ULL, 0x4984104A00000101ULL,
+			0x4004030818283008ULL, 0x0206012462000121ULL, 0x1A02013008040001ULL, 0x0001008044200440ULL,
+			0x0000312208080880ULL, 0x0220021002009900ULL, 0x8080880801082000ULL, 0x000C11040080102AULL,
+			0x1402440421000210ULL, 0x0010120802080A81ULL, 0x0080084202104028ULL, 0x1100002082082082ULL,
+			0x0008403429080820ULL, 0x8104868204040412ULL, 0x6424084043060030ULL, 0x1108000420401000ULL,
+			0x9004101202020240ULL, 0x0032400608200412ULL, 0x0001009610822080ULL, 0x0008403429080820ULL,
+			0x0008068340104200ULL, 0x0010102858090121ULL, 0x81004C0018080313ULL, 0x4048080004820002ULL,
+			0x000900401C004049ULL, 0x0009420121C1101CULL, 0x4828504005040211ULL, 0x4828504005040211ULL,
+			0x0041041381202000ULL, 0x01008C1005601680ULL, 0x01D010900002040AULL, 0x4040020080080080ULL,
+			0x4801080200802200ULL, 0x4801080200802200ULL, 0x0010046108108080ULL, 0x90409090810A0220ULL,
+			0x8004020242201020ULL, 0x8004020242201020ULL, 0x0202010028020480ULL, 0x0000041144000801ULL,
+			0x00002000A4021080ULL, 0x0504090045040200ULL, 0x8182041102094400ULL, 0x0550008100480101ULL,
+			0xC002080404040400ULL, 0x0382004108292000ULL, 0x12000100A8040020ULL, 0xA005020442088020ULL,
+			0x2000001102020300ULL, 0x000021E0420C8808ULL, 0x3060200484888400ULL, 0x01280101021A0802ULL,
+			0x1030820110010500ULL, 0x0080012608025800ULL, 0x0002810084008800ULL, 0x800080000C208800ULL,
+			0xA408002140028204ULL, 0x0010006020322084ULL, 0x0210401044110050ULL, 0x40106000A1160020ULL
+		};
+
+		void initMagics(Magic magics[64], Bitboard table[], const Bitboard magicNumbers[64], const int8_t directions[4][2]) {
+			size_t offset = 0;
+			for (int8_t pos = 0; pos < 64; pos++) {
+				Bitboard edges = ((ROW_8 | ROW_1) & ~(ROW_8 << (8 * getRow(pos)))) | ((COLUMN_A | COLUMN_H) & ~(COLUMN_A << getColumn(pos)));
+				Magic& m = magics[pos];
+				m.mask = computeSlidingAttacks(pos, 0, directions) & ~edges;
+				m.magic = magicNumbers[pos];
+				m.shift = 64 - popCount(m.mask);
+				m.attacks = table + offset;
+				offset += size_t(1) << popCount(m.mask);
+
+				// enumerate all subsets of the mask (carry-rippler)
+				Bitboard b = 0;
+				do {
+					Bitboard attacks = computeSlidingAttacks(pos, b, directions);
+					Bitboard& entry = m.attacks[m.index(b)];
+					if (entry && entry != attacks) throw "bad magic number";
+					entry = attacks;
+					b = (b - m.mask) & m.mask;
+				} while (b);
+			}
+		}
+
+		void init() {  // slider attacks stay runtime tables, they are too large to build at compile time
+			initMagics(rookMagics, rookTable, rookMagicNumbers, rookDirections);
+			initMagics(bishopMagics, bishopTable, bishopMagicNumbers, bishopDirections);
+		}
+
+		const bool initialized = (init(), true);  // tables are ready before main
+
+		struct Bitboards {
+			std::array<Bitboard, 13> pieces = {};  // indexed by SquareId, pieces[empty] is unused
+			std::array<Bitboard, 2> colors = {};  // [0] = black, [1] = white
+			Bitboard occupied = 0;
+
+			Bitboards() {}
+
+			explicit Bitboards(const std::array<SquareId, 64>& board) {
+				for (int8_t i = 0; i < 64; i++) {
+					if (board[i] != empty) putPiece(board[i], i);
+				}
 			}
-			for (int8_t i = pos - 8; i >= 0; i -= 8) {  // up
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+
+			void putPiece(SquareId piece, int8_t pos) {
+				Bitboard b = squareBit(pos);
+				pieces[piece] |= b;
+				colors[piece % 2] |= b;
+				occupied |= b;
 			}
-			std::reverse(res.begin(), res.end());
-			for (int8_t i = pos + 1; i < (y + 1) * 8; i++) {  // right
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+
+			void removePiece(SquareId piece, int8_t pos) {
+				Bitboard b = squareBit(pos);
+				pieces[piece] ^= b;
+				colors[piece % 2] ^= b;
+				occupied ^= b;
 			}
-			for (int8_t i = pos + 8; i < 64; i += 8) {  // down
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+
+			void movePiece(SquareId piece, int8_t from, int8_t to) {  // to must be empty
+				Bitboard b = squareBit(from) | squareBit(to);
+				pieces[piece] ^= b;
+				colors[piece % 2] ^= b;
+				occupied ^= b;
 			}
-			return res;
+
+			Bitboard getPieces(PieceId piece, bool color) const {
+				return pieces[getSquareId(piece, color)];
+			}
+		};
+
+	}
+
+	typedef uint16_t Move;  // bits 0-5: to, 6-11: from, 12-13: promotion piece - knight, 14-15: MoveFlag
+	enum MoveFlag { normalMove = 0, promotionMove = 1 << 14, enPassantMove = 2 << 14, castlingMove = 3 << 14 };
+	const Move NULL_MOVE = 0;  // a8a8, never a real move
+
+	inline Move createMove(int8_t from, int8_t to, MoveFlag flag = normalMove, PieceId promotion = knight) {
+		return Move(flag | ((promotion - knight) << 12) | (from << 6) | to);
+	}
+
+	inline int8_t getMoveFrom(Move move) {
+		return (move >> 6) & 63;
+	}
+
+	inline int8_t getMoveTo(Move move) {
+		return move & 63;
+	}
+
+	inline MoveFlag getMoveFlag(Move move) {
+		return MoveFlag(move & (3 << 14));
+	}
+
+	inline PieceId getMovePromotion(Move move) {  // only meaningful for promotionMove
+		return PieceId(((move >> 12) & 3) + knight);
+	}
+
+	struct MoveList {  // fixed capacity, lives on the stack
+		static const size_t MAX_MOVES = 256;  // max legal moves in any position is 218
+		std::array<Move, MAX_MOVES> moves;  // left uninitialized on purpose
+		size_t count = 0;
+
+		void push_back(Move move) {
+			moves[count++] = move;
+		}
+
+		void resize(size_t n) {
+			count = n;
+		}
+
+		void clear() {
+			count = 0;
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		Move& operator[](size_t i) {
+			return moves[i];
+		}
+
+		Move operator[](size_t i) const {
+			return moves[i];
+		}
+
+		Move* begin() {
+			return moves.data();
+		}
+
+		Move* end() {
+			return moves.data() + count;
+		}
+
+		const Move* begin() const {
+			return moves.data();
+		}
+
+		const Move* end() const {
+			return moves.data() + count;
+		}
+	};
+
+	namespace pieceMovement {
+		// not necessarly legal movement
+
+		// which moves a generator produces, resolved at compile time
+		enum GenerationType {
+			allMoves,
+			captureMoves,  // captures and en passant
+			quietMoves,  // everything that does not capture
+			evasionMoves,  // all moves, only generated while in check
+			checkMoves  // moves that give check, directly or by uncovering a slider
+		};
+
+		template <int8_t DIRECTION>
+		inline bitboard::Bitboard shift(bitboard::Bitboard b) {
+			if constexpr (DIRECTION > 0) return b << DIRECTION;
+			else return b >> -DIRECTION;
+		}
+
+		// pawn geometry of a color, all known at compile time
+		template <bool COLOR>
+		struct PawnDirections {
+			static constexpr int8_t FORWARD = COLOR ? -8 : 8;
+			static constexpr int8_t CAPTURE_WEST = FORWARD - 1;  // towards column a
+			static constexpr int8_t CAPTURE_EAST = FORWARD + 1;  // towards column h
+			static constexpr bitboard::Bitboard DOUBLE_PUSH_ROW = COLOR ? bitboard::ROW_1 >> 16 : bitboard::ROW_8 << 16;  // row reached by a single push from the start row
+			static constexpr bitboard::Bitboard PROMOTION_ROW = COLOR ? bitboard::ROW_8 : bitboard::ROW_1;
+		};
+
+		const std::array<bool, 4> NO_CASTLING = { false, false, false, false };
+		const PieceId PROMOTION_PIECES[] = { queen, rook, bishop, knight };
+		const bitboard::Bitboard PROMOTION_ROWS = bitboard::ROW_8 | bitboard::ROW_1;  // a pawn only ever reaches the one in front of it
+
+		void appendMoves(int8_t from, bitboard::Bitboard targets, MoveList& moves) {
+			while (targets) moves.push_back(createMove(from, bitboard::popLsb(targets)));
+		}
+
+		void appendPromotions(int8_t from, int8_t to, MoveList& moves) {
+			for (PieceId piece : PROMOTION_PIECES) moves.push_back(createMove(from, to, promotionMove, piece));
 		}
 
-		std::vector<int8_t> computePossibleMoves_Queen(const std::array<SquareId, 64>& board, int8_t pos, bool color) {  // unordered
-			div_t d = std::div(pos, 8);
-			int8_t x = d.rem;
-			int8_t y = d.quot;
-			std::vector<int8_t> res;
-			for (int8_t i = pos - 7; i >= pos - 7 * std::min<int8_t>(7 - x, y); i -= 7) {  // up-right
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			for (int8_t i = pos + 9; i <= pos + 9 * std::min<int8_t>(7 - x, 7 - y); i += 9) {  // down-right
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			for (int8_t i = pos + 7; i <= pos + 7 * std::min<int8_t>(x, 7 - y); i += 7) {  // down-left
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			for (int8_t i = pos - 9; i >= pos - 9 * std::min<int8_t>(x, y); i -= 9) {  // up-left
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			for (int8_t i = pos - 1; i >= 8 * y; i--) {  // left
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			for (int8_t i = pos - 8; i >= 0; i -= 8) {  // up
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			std::reverse(res.begin(), res.end());
-			for (int8_t i = pos + 1; i < (y + 1) * 8; i++) {  // right
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
-			}
-			for (int8_t i = pos + 8; i < 64; i += 8) {  // down
-				if (board[i] != empty && color == getPieceColor(board[i])) break;
-				res.push_back(i);
-				if (board[i] != empty && color != getPieceColor(board[i])) break;
+		template <int8_t DIRECTION>
+		void appendPawnMoves(bitboard::Bitboard targets, MoveList& moves) {  // targets of a whole pawn set shifted by DIRECTION
+			bitboard::Bitboard promotions = targets & PROMOTION_ROWS;
+			targets ^= promotions;
+			while (targets) {
+				int8_t to = bitboard::popLsb(targets);
+				moves.push_back(createMove(to - DIRECTION, to));
 			}
-			return res;
+			while (promotions) {
+				int8_t to = bitboard::popLsb(promotions);
+				appendPromotions(to - DIRECTION, to, moves);
+			}
+		}
+
+		template <bool COLOR>
+		bitboard::Bitboard computePawnTargets(const bitboard::Bitboards& bb, int8_t pos) {  // pushes and captures, no en passant
+			typedef PawnDirections<COLOR> Pawn;
+			const bitboard::Bitboard single = shift<Pawn::FORWARD>(bitboard::squareBit(pos)) & ~bb.occupied;
+			const bitboard::Bitboard pushes = single | (shift<Pawn::FORWARD>(single & Pawn::DOUBLE_PUSH_ROW) & ~bb.occupied);
+			return pushes | (bitboard::pawnAttacks[COLOR][pos] & bb.colors[!COLOR]);
+		}
+
+		template <bool COLOR>
+		void computePossibleMoves_Pawn(const bitboard::Bitboards& bb, int8_t pos, int8_t enPassantTarget, MoveList& moves) {
+			const bitboard::Bitboard targets = computePawnTargets<COLOR>(bb, pos);
+			appendMoves(pos, targets & ~PROMOTION_ROWS, moves);
+			bitboard::Bitboard promotions = targets & PROMOTION_ROWS;
+			while (promotions) appendPromotions(pos, bitboard::popLsb(promotions), moves);
+			if (enPassantTarget != -1 && (bitboard::pawnAttacks[COLOR][pos] & bitboard::squareBit(enPassantTarget))) moves.push_back(createMove(pos, enPassantTarget, enPassantMove));
+		}
+
+		void computePossibleMoves_Knight(const bitboard::Bitboards& bb, int8_t pos, bool color, MoveList& moves) {  // ordered
+			appendMoves(pos, bitboard::knightAttacks[pos] & ~bb.colors[color], moves);
+		}
+
+		void computePossibleMoves_Bishop(const bitboard::Bitboards& bb, int8_t pos, bool color, MoveList& moves) {  // ordered
+			appendMoves(pos, bitboard::bishopAttacks(pos, bb.occupied) & ~bb.colors[color], moves);
+		}
+
+		void computePossibleMoves_Rook(const bitboard::Bitboards& bb, int8_t pos, bool color, MoveList& moves) {  // ordered
+			appendMoves(pos, bitboard::rookAttacks(pos, bb.occupied) & ~bb.colors[color], moves);
+		}
+
+		void computePossibleMoves_Queen(const bitboard::Bitboards& bb, int8_t pos, bool color, MoveList& moves) {  // ordered
+			appendMoves(pos, bitboard::queenAttacks(pos, bb.occupied) & ~bb.colors[color], moves);
 		}
 
 
 		// NOT including castling
-		std::vector<int8_t> computePossibleMoves_King_Simple(const std::array<SquareId, 64>& board, int8_t pos, bool color) {  // ordered
-			div_t d = std::div(pos, 8);
-			int8_t x = d.rem;
-			int8_t y = d.quot;
-			std::vector<int8_t> res;
-			bool canGoUp = (y != 0);
-			bool canGoDown = (y != 7);
-			bool canGoRight = (x != 7);
-			bool canGoLeft = (x != 0);
-			if (canGoLeft 	&& canGoUp 		&& (board[pos - 9] == empty || color != getPieceColor(board[pos - 9])))	res.push_back(pos - 9);
-			if (canGoUp 						&& (board[pos - 8] == empty || color != getPieceColor(board[pos - 8])))	res.push_back(pos - 8);
-			if (canGoUp 	&& canGoRight 	&& (board[pos - 7] == empty || color != getPieceColor(board[pos - 7])))	res.push_back(pos - 7);
-			if (canGoLeft 						&& (board[pos - 1] == empty || color != getPieceColor(board[pos - 1])))	res.push_back(pos - 1);
-			if (canGoRight 					&& (board[pos + 1] == empty || color != getPieceColor(board[pos + 1])))	res.push_back(pos + 1);
-			if (canGoDown 	&& canGoLeft 	&& (board[pos + 7] == empty || color != getPieceColor(board[pos + 7])))  	res.push_back(pos + 7);
-			if (canGoDown 						&& (board[pos + 8] == empty || color != getPieceColor(board[pos + 8])))	res.push_back(pos + 8);
-			if (canGoRight && canGoDown 	&& (board[pos + 9] == empty || color != getPieceColor(board[pos + 9])))	res.push_back(pos + 9);
-			return res;
+		void computePossibleMoves_King_Simple(const bitboard::Bitboards& bb, int8_t pos, bool color, MoveList& moves) {  // ordered
+			appendMoves(pos, bitboard::kingAttacks[pos] & ~bb.colors[color], moves);
 		}
 
-		std::vector<int8_t> computePossiblePieceMoves_Simple(const std::array<SquareId, 64>& board, int8_t pos, int8_t enPassantTarget, bool color) { //TODO
+		void computePossiblePieceMoves_Simple(const std::array<SquareId, 64>& board, const bitboard::Bitboards& bb, int8_t pos, int8_t enPassantTarget, bool color, MoveList& moves) {
 			if (pos > 63) throw "position number too big 235231";
-			if (board[pos] == empty) throw "empty square has no movement";
 			if (enPassantTarget < -1 || enPassantTarget > 63) throw "wrong enpassant 460186";
-			if (board[pos] == wpawn && enPassantTarget == -1) return computePossibleMoves_WhitePawn_NoEnPassant(board, pos);
-			if (board[pos] == wpawn && enPassantTarget != -1) return computePossibleMoves_WhitePawn_WithEnPassant(board, pos, enPassantTarget);
-			if (board[pos] == bpawn && enPassantTarget == -1) return computePossibleMoves_BlackPawn_NoEnPassant(board, pos);
-			if (board[pos] == bpawn && enPassantTarget != -1) return computePossibleMoves_BlackPawn_WithEnPassant(board, pos, enPassantTarget);
-			if (board[pos] == wknight || board[pos] == bknight) return computePossibleMoves_Knight(board, pos, color);
-			if (board[pos] == wbishop || board[pos] == bbishop) return computePossibleMoves_Bishop(board, pos, color);
-			if (board[pos] == wrook || board[pos] == brook) return computePossibleMoves_Rook(board, pos, color);
-			if (board[pos] == wqueen || board[pos] == bqueen) return computePossibleMoves_Queen(board, pos, color);
-			if (board[pos] == wking || board[pos] == bking) return computePossibleMoves_King_Simple(board, pos, color);
+			switch (board[pos]) {
+				case wpawn: return computePossibleMoves_Pawn<true>(bb, pos, enPassantTarget, moves);
+				case bpawn: return computePossibleMoves_Pawn<false>(bb, pos, enPassantTarget, moves);
+				case wknight: case bknight: return computePossibleMoves_Knight(bb, pos, color, moves);
+				case wbishop: case bbishop: return computePossibleMoves_Bishop(bb, pos, color, moves);
+				case wrook: case brook: return computePossibleMoves_Rook(bb, pos, color, moves);
+				case wqueen: case bqueen: return computePossibleMoves_Queen(bb, pos, color, moves);
+				case wking: case bking: return computePossibleMoves_King_Simple(bb, pos, color, moves);
+				case empty: throw "empty square has no movement";
+			}
 			throw "random error 134125";
 		}
 
 
+		int8_t findKing(const bitboard::Bitboards& bb, bool color) {
+			bitboard::Bitboard king = bb.getPieces(chess::king, color);
+			if (!king) throw "findKing error 23i5u2395";
+			return bitboard::getLsb(king);
+		}
+
 		int8_t findKing(const std::array<SquareId, 64>& board, bool color) {
 			SquareId searchFor = color ? wking : bking;
 			for (int8_t i = 0; i < 64; i++) {
@@ -237,164 +734,294 @@ namespace chess {
 			throw "findKing error 23i5u2395";
 		}
 
+		bool isSquareAttacked(const bitboard::Bitboards& bb, bool color, int8_t pos) {
+			CHESS_STATS_TIME(attackChecks);
+			// look from the square with each piece movement and check if an enemy piece of that type is there
+			bitboard::Bitboard queens = bb.getPieces(queen, !color);
+			return (bitboard::pawnAttacks[color][pos] & bb.getPieces(pawn, !color))
+				|| (bitboard::knightAttacks[pos] & bb.getPieces(knight, !color))
+				|| (bitboard::kingAttacks[pos] & bb.getPieces(king, !color))
+				|| (bitboard::bishopAttacks(pos, bb.occupied) & (bb.getPieces(bishop, !color) | queens))
+				|| (bitboard::rookAttacks(pos, bb.occupied) & (bb.getPieces(rook, !color) | queens));
+		}
+
 		bool isSquareAttacked(const std::array<SquareId, 64>& board, bool color, int8_t pos) {
-			/*
-			- compute rook movement from king : if movement square is queen or rook ret true
-			- compute bishop movemet from king : if movement square is queen or bishop ret true
-			- compute knight movement from king: if movement square is knight ret true
-			- compute king movement from king: if movement square is king ret true
-			- compute pawn squares and check if pawn
-			*/
+			return isSquareAttacked(bitboard::Bitboards(board), color, pos);
+		}
 
-			if (color) {
+		bitboard::Bitboard computeAttackers(const bitboard::Bitboards& bb, int8_t pos, bitboard::Bitboard occupied) {  // pieces of both colors
+			bitboard::Bitboard queens = bb.pieces[wqueen] | bb.pieces[bqueen];
+			return (bitboard::pawnAttacks[1][pos] & bb.pieces[bpawn])
+				| (bitboard::pawnAttacks[0][pos] & bb.pieces[wpawn])
+				| (bitboard::knightAttacks[pos] & (bb.pieces[wknight] | bb.pieces[bknight]))
+				| (bitboard::kingAttacks[pos] & (bb.pieces[wking] | bb.pieces[bking]))
+				| (bitboard::bishopAttacks(pos, occupied) & (bb.pieces[wbishop] | bb.pieces[bbishop] | queens))
+				| (bitboard::rookAttacks(pos, occupied) & (bb.pieces[wrook] | bb.pieces[brook] | queens));
+		}
 
-				if (pos > 8) {
-					if (pos % 8 != 0 && board[pos - 9] == bpawn) return true;
-					if (pos % 8 != 7 && board[pos - 7] == bpawn) return true;
-				}
-				for (int8_t p : computePossibleMoves_Rook(board, pos, color)) {
-					if (board[p] == brook || board[p] == bqueen) return true;
-				}
-				for (int8_t p : computePossibleMoves_Bishop(board, pos, color)) {
-					if (board[p] == bbishop || board[p] == bqueen) return true;
-				}
-				for (int8_t p : computePossibleMoves_Knight(board, pos, color)) {
-					if (board[p] == bknight) return true;
-				}
-				for (int8_t p : computePossibleMoves_King_Simple(board, pos, color)) {
-					if (board[p] == bking) return true;
-				}
-				
+		template <bool COLOR>
+		inline bitboard::Bitboard computePawnAttacks(bitboard::Bitboard pawns) {
+			return shift<PawnDirections<COLOR>::CAPTURE_WEST>(pawns & ~bitboard::COLUMN_A) | shift<PawnDirections<COLOR>::CAPTURE_EAST>(pawns & ~bitboard::COLUMN_H);
+		}
 
-			} else {
+		// every square a piece of color attacks, in one pass over its pieces
+		// the enemy king is taken out of the occupancy, so the squares behind it on a slider line count too (it cannot step back there)
+		bitboard::Bitboard computeAttackedSquares(const bitboard::Bitboards& bb, bool color) {
+			const bitboard::Bitboard occupied = bb.occupied ^ bb.getPieces(king, !color);
+			const bitboard::Bitboard queens = bb.getPieces(queen, color);
+			bitboard::Bitboard res = color ? computePawnAttacks<true>(bb.pieces[wpawn]) : computePawnAttacks<false>(bb.pieces[bpawn]);
+			res |= bitboard::kingAttacks[bitboard::getLsb(bb.getPieces(king, color))];
+			bitboard::Bitboard pieces = bb.getPieces(knight, color);
+			while (pieces) res |= bitboard::knightAttacks[bitboard::popLsb(pieces)];
+			pieces = bb.getPieces(bishop, color) | queens;
+			while (pieces) res |= bitboard::bishopAttacks(bitboard::popLsb(pieces), occupied);
+			pieces = bb.getPieces(rook, color) | queens;
+			while (pieces) res |= bitboard::rookAttacks(bitboard::popLsb(pieces), occupied);
+			return res;
+		}
 
-				if (pos < 56) {
-					if (pos % 8 != 0 && board[pos + 7] == wpawn) return true;
-					if (pos % 8 != 7 && board[pos + 9] == wpawn) return true;
-				}
-				for (int8_t p : computePossibleMoves_Rook(board, pos, color)) {
-					if (board[p] == wrook || board[p] == wqueen) return true;
-				}
-				for (int8_t p : computePossibleMoves_Bishop(board, pos, color)) {
-					if (board[p] == wbishop || board[p] == wqueen) return true;
-				}
-				for (int8_t p : computePossibleMoves_Knight(board, pos, color)) {
-					if (board[p] == wknight) return true;
-				}
-				for (int8_t p : computePossibleMoves_King_Simple(board, pos, color)) {
-					if (board[p] == wking) return true;
-				}
-				
+		bitboard::Bitboard computeSliderBlockers(const bitboard::Bitboards& bb, int8_t square, bool sniperColor) {
+			// pieces of either color that are the only piece between square and a slider of sniperColor
+			bitboard::Bitboard queens = bb.getPieces(queen, sniperColor);
+			bitboard::Bitboard snipers = (bitboard::rookRays[square] & (bb.getPieces(rook, sniperColor) | queens))
+				| (bitboard::bishopRays[square] & (bb.getPieces(bishop, sniperColor) | queens));
+			bitboard::Bitboard res = 0;
+			while (snipers) {
+				bitboard::Bitboard blockers = bitboard::betweenSquares[square][bitboard::popLsb(snipers)] & bb.occupied;
+				if (blockers && !(blockers & (blockers - 1))) res |= blockers;
 			}
+			return res;
+		}
 
-			return false;
+		bitboard::Bitboard computePinnedPieces(const bitboard::Bitboards& bb, int8_t kingSquare, bool color) {
+			CHESS_STATS_TIME(legalityFiltering);
+			return computeSliderBlockers(bb, kingSquare, !color) & bb.colors[color];
 		}
 
 
 		bool isOnCornerOfBoard(int8_t pos) {
-			return (pos == 0 || pos == 7 || pos == 56 || pos == 63);
+			return bitboard::CORNER_SQUARES & bitboard::squareBit(pos);
 		}
 
 		bool isOnEdgeOfBoard(int8_t pos) {
-			return ((pos >= 0 && pos <= 8) || (pos >= 55 && pos <= 63) || (pos % 8 == 0) || (pos % 8 == 7));
+			return bitboard::EDGE_SQUARES & bitboard::squareBit(pos);
 		}
 
 		bool isInSameLineOrDiagonal(int8_t pos1, int8_t pos2) {
-			div_t d1 = std::div(pos1, 8);
-			int8_t x1 = d1.rem;
-			int8_t y1 = d1.quot;
-			div_t d2 = std::div(pos2, 8);
-			int8_t x2 = d2.rem;
-			int8_t y2 = d2.quot;
-			return (x1 == x2 || y1 == y2 || std::abs(x2 - x1) == std::abs(y2 - y1));
+			return pos1 == pos2 || bitboard::lineSquares[pos1][pos2];
 		}
 
 
 
-		std::vector<std::pair<int8_t, int8_t>> computeLegalMoves_Simple(const std::array<SquareId, 64>& board, bool color, int8_t enPassantTarget) {
-			std::vector<std::pair<int8_t, int8_t>> res;
-			int8_t kingSquare = findKing(board, color);
-			for (int8_t i = 0; i < 64; i++) {
-				if (board[i] != empty && getPieceColor(board[i]) == color) {  // if pieces of right color...
+		// checkers and pinned pieces are computed once: pinned pieces stay on their pin line and
+		// in check only moves landing on the checker or between it and the king are generated
+		// unpinned pawns are moved as a whole set with compile time shifts
+		// castling, promotions and en passant are tested on bitboards in the same pass, the board is never copied
+		// COUNT_ONLY: moves are only counted (perft leaves), nothing is written to moves
+		// enemyAttacks: the computeAttackedSquares map of the enemy if the caller has it, else it is computed here when the king can move
+		template <bool COLOR, GenerationType TYPE, bool COUNT_ONLY>
+		size_t generateLegalMoves(const bitboard::Bitboards& bb, int8_t enPassantTarget, const std::array<bool, 4>& castlingAvailability,
+			MoveList* moves, const bitboard::Bitboard* enemyAttacks = nullptr) {
+			CHESS_STATS_TIME(moveGeneration);
+			typedef PawnDirections<COLOR> Pawn;
+			const SquareId PAWN = COLOR ? wpawn : bpawn;
+			size_t count = 0;
+			auto addMoves = [&](int8_t from, bitboard::Bitboard targets) {
+				if (COUNT_ONLY) count += bitboard::popCount(targets);
+				else appendMoves(from, targets, *moves);
+			};
+			const int8_t kingSquare = bitboard::getLsb(bb.pieces[COLOR ? wking : bking]);
+			const bitboard::Bitboard own = bb.colors[COLOR];
+			const bitboard::Bitboard enemy = bb.colors[!COLOR];
+			const bitboard::Bitboard checkers = computeAttackers(bb, kingSquare, bb.occupied) & enemy;
+			if (TYPE == evasionMoves && !checkers) return 0;
 
-					if (board[i] == wking || board[i] == bking) {
-						for (int8_t j : computePossibleMoves_King_Simple(board, i, color)) {
-							if (!isSquareAttacked(board, color, j)) {
-								res.push_back(std::pair<int8_t, int8_t>(i, j));
-							}
-						}
+			// squares a piece of each type has to reach to give check, and our pieces whose move uncovers a slider
+			int8_t enemyKing = 0;
+			bitboard::Bitboard checkSquares[6] = {};
+			bitboard::Bitboard discoverers = 0;
+			if (TYPE == checkMoves) {
+				enemyKing = bitboard::getLsb(bb.pieces[COLOR ? bking : wking]);
+				checkSquares[pawn] = bitboard::pawnAttacks[!COLOR][enemyKing];
+				checkSquares[knight] = bitboard::knightAttacks[enemyKing];
+				checkSquares[bishop] = bitboard::bishopAttacks(enemyKing, bb.occupied);
+				checkSquares[rook] = bitboard::rookAttacks(enemyKing, bb.occupied);
+				checkSquares[queen] = checkSquares[bishop] | checkSquares[rook];
+				discoverers = computeSliderBlockers(bb, enemyKing, COLOR) & own;
+			}
+			auto checkMask = [&](PieceId piece, int8_t from) -> bitboard::Bitboard {
+				if (TYPE != checkMoves) return ~bitboard::Bitboard(0);
+				return checkSquares[piece] | ((discoverers & bitboard::squareBit(from)) ? ~bitboard::lineSquares[enemyKing][from] : 0);
+			};
+			// a promotion gives check with the new piece, the pawn square is empty by then
+			auto givesCheckAsPromotion = [&](PieceId piece, int8_t from, int8_t to) -> bool {
+				if ((discoverers & bitboard::squareBit(from)) && !(bitboard::lineSquares[enemyKing][from] & bitboard::squareBit(to))) return true;
+				const bitboard::Bitboard occupied = (bb.occupied ^ bitboard::squareBit(from)) | bitboard::squareBit(to);
+				switch (piece) {
+					case knight: return bitboard::knightAttacks[to] & bitboard::squareBit(enemyKing);
+					case bishop: return bitboard::bishopAttacks(to, occupied) & bitboard::squareBit(enemyKing);
+					case rook: return bitboard::rookAttacks(to, occupied) & bitboard::squareBit(enemyKing);
+					default: return bitboard::queenAttacks(to, occupied) & bitboard::squareBit(enemyKing);
+				}
+			};
+			auto addPromotions = [&](int8_t from, bitboard::Bitboard targets) {
+				while (targets) {
+					int8_t to = bitboard::popLsb(targets);
+					for (PieceId piece : PROMOTION_PIECES) {
+						if (TYPE == checkMoves && !givesCheckAsPromotion(piece, from, to)) continue;
+						if (COUNT_ONLY) count++;
+						else moves->push_back(createMove(from, to, promotionMove, piece));
+					}
+				}
+			};
+			const bitboard::Bitboard typeMask = TYPE == captureMoves ? enemy : (TYPE == quietMoves ? ~bb.occupied : ~own);
+			bitboard::Bitboard attacked = 0;  // enemyAttacks, computed on first use
+			bool attackedKnown = false;
+			auto getAttacked = [&]() -> bitboard::Bitboard {
+				if (!attackedKnown) {
+					attacked = enemyAttacks ? *enemyAttacks : computeAttackedSquares(bb, !COLOR);
+					attackedKnown = true;
+				}
+				return attacked;
+			};
 
-					} else {
+			// king moves, the attack map sees through the king so it cannot hide behind itself
+			bitboard::Bitboard kingTargets = bitboard::kingAttacks[kingSquare] & typeMask & checkMask(king, kingSquare);
+			if (kingTargets) {
+				CHESS_STATS_TIME(legalityFiltering);
+				kingTargets &= ~getAttacked();
+			}
+			addMoves(kingSquare, kingTargets);
+			if (checkers & (checkers - 1)) return count;  // double check, only the king can move
 
-						// if i could allow discoveries: check for legality
-						if (board[i] == wpawn || board[i] == bpawn || (!isOnEdgeOfBoard(i) && isInSameLineOrDiagonal(i, kingSquare))) {
-							for (int8_t j : computePossiblePieceMoves_Simple(board, i, enPassantTarget, color)) {
-								std::array<SquareId, 64> boardCopy = board;
-								boardCopy[j] = boardCopy[i];
-								boardCopy[i] = empty;
-								if (!isSquareAttacked(boardCopy, color, kingSquare)) {
-									res.push_back(std::pair<int8_t, int8_t>(i, j));
-								}
-							}
-						} else {
-							for (int8_t j : computePossiblePieceMoves_Simple(board, i, enPassantTarget, color)) {
-								res.push_back(std::pair<int8_t, int8_t>(i, j));
-							}
-						}
+			// castling: the squares up to the rook are empty, the king is not in check and does not pass or land on an attacked square
+			const int8_t KING_START = COLOR ? 60 : 4;
+			const bool* rights = &castlingAvailability[COLOR ? 0 : 2];  // kingside, queenside
+			if (TYPE != captureMoves && TYPE != evasionMoves && !checkers && kingSquare == KING_START && (rights[0] || rights[1])) {
+				for (int side = 0; side < 2; side++) {
+					const int8_t rookSquare = side ? KING_START - 4 : KING_START + 3;
+					const int8_t kingTo = side ? KING_START - 2 : KING_START + 2;
+					if (!rights[side] || !(bb.pieces[COLOR ? wrook : brook] & bitboard::squareBit(rookSquare))) continue;
+					if (bitboard::betweenSquares[KING_START][rookSquare] & bb.occupied) continue;
+					if ((bitboard::betweenSquares[KING_START][kingTo] | bitboard::squareBit(kingTo)) & getAttacked()) continue;
+					if (TYPE == checkMoves) {  // only the rook can give check
+						const int8_t rookTo = (KING_START + kingTo) / 2;
+						const bitboard::Bitboard occupied = bb.occupied ^ bitboard::squareBit(KING_START) ^ bitboard::squareBit(rookSquare)
+							^ bitboard::squareBit(kingTo) ^ bitboard::squareBit(rookTo);
+						if (!(bitboard::rookAttacks(rookTo, occupied) & bitboard::squareBit(enemyKing))) continue;
 					}
+					if (COUNT_ONLY) count++;
+					else moves->push_back(createMove(KING_START, kingTo, castlingMove));
 				}
 			}
-			return res;
+
+			const bitboard::Bitboard targetMask = typeMask & (checkers ? checkers | bitboard::betweenSquares[kingSquare][bitboard::getLsb(checkers)] : ~bitboard::Bitboard(0));
+			const bitboard::Bitboard pinned = computePinnedPieces(bb, kingSquare, COLOR);
+			auto pinMask = [&](int8_t from) -> bitboard::Bitboard {
+				return (pinned & bitboard::squareBit(from)) ? bitboard::lineSquares[kingSquare][from] : ~bitboard::Bitboard(0);
+			};
+
+			bitboard::Bitboard pieces = bb.getPieces(knight, COLOR) & ~pinned;  // a pinned knight can never move
+			while (pieces) {
+				int8_t from = bitboard::popLsb(pieces);
+				addMoves(from, bitboard::knightAttacks[from] & targetMask & checkMask(knight, from));
+			}
+			pieces = bb.getPieces(bishop, COLOR);
+			while (pieces) {
+				int8_t from = bitboard::popLsb(pieces);
+				addMoves(from, bitboard::bishopAttacks(from, bb.occupied) & targetMask & pinMask(from) & checkMask(bishop, from));
+			}
+			pieces = bb.getPieces(rook, COLOR);
+			while (pieces) {
+				int8_t from = bitboard::popLsb(pieces);
+				addMoves(from, bitboard::rookAttacks(from, bb.occupied) & targetMask & pinMask(from) & checkMask(rook, from));
+			}
+			pieces = bb.getPieces(queen, COLOR);
+			while (pieces) {
+				int8_t from = bitboard::popLsb(pieces);
+				addMoves(from, bitboard::queenAttacks(from, bb.occupied) & targetMask & pinMask(from) & checkMask(queen, from));
+			}
+
+			// pinned pawns, and every pawn when looking for checks, go one by one
+			const bitboard::Bitboard setPawns = TYPE == checkMoves ? 0 : bb.pieces[PAWN] & ~pinned;
+			pieces = bb.pieces[PAWN] & ~setPawns;
+			while (pieces) {
+				int8_t from = bitboard::popLsb(pieces);
+				const bitboard::Bitboard targets = computePawnTargets<COLOR>(bb, from) & targetMask & pinMask(from);
+				addMoves(from, targets & ~Pawn::PROMOTION_ROW & checkMask(pawn, from));
+				addPromotions(from, targets & Pawn::PROMOTION_ROW);
+			}
+			if (setPawns) {
+				auto addPawnMoves = [&](auto direction, bitboard::Bitboard targets) {
+					if (COUNT_ONLY) count += bitboard::popCount(targets) + 3 * bitboard::popCount(targets & Pawn::PROMOTION_ROW);
+					else appendPawnMoves<decltype(direction)::value>(targets, *moves);
+				};
+				if (TYPE != captureMoves) {
+					const bitboard::Bitboard singlePush = shift<Pawn::FORWARD>(setPawns) & ~bb.occupied;
+					const bitboard::Bitboard doublePush = shift<Pawn::FORWARD>(singlePush & Pawn::DOUBLE_PUSH_ROW) & ~bb.occupied;
+					addPawnMoves(std::integral_constant<int8_t, Pawn::FORWARD>(), singlePush & targetMask);
+					addPawnMoves(std::integral_constant<int8_t, 2 * Pawn::FORWARD>(), doublePush & targetMask);
+				}
+				if (TYPE != quietMoves) {
+					addPawnMoves(std::integral_constant<int8_t, Pawn::CAPTURE_WEST>(), shift<Pawn::CAPTURE_WEST>(setPawns & ~bitboard::COLUMN_A) & enemy & targetMask);
+					addPawnMoves(std::integral_constant<int8_t, Pawn::CAPTURE_EAST>(), shift<Pawn::CAPTURE_EAST>(setPawns & ~bitboard::COLUMN_H) & enemy & targetMask);
+				}
+			}
+
+			// en passant takes two pawns off a row (and maybe a diagonal), so the king is tested again on the occupancy after the capture
+			if (TYPE != quietMoves && enPassantTarget != -1) {
+				const int8_t capturedPos = enPassantTarget - Pawn::FORWARD;
+				pieces = bitboard::pawnAttacks[!COLOR][enPassantTarget] & bb.pieces[PAWN];
+				while (pieces) {
+					int8_t from = bitboard::popLsb(pieces);
+					CHESS_STATS_TIME(legalityFiltering);
+					const bitboard::Bitboard occupied = (bb.occupied ^ bitboard::squareBit(from) ^ bitboard::squareBit(capturedPos)) | bitboard::squareBit(enPassantTarget);
+					if (computeAttackers(bb, kingSquare, occupied) & enemy & ~bitboard::squareBit(capturedPos)) continue;
+					if (TYPE == checkMoves) {
+						const bitboard::Bitboard queens = bb.getPieces(queen, COLOR);
+						if (!(bitboard::pawnAttacks[!COLOR][enemyKing] & bitboard::squareBit(enPassantTarget))
+							&& !(bitboard::bishopAttacks(enemyKing, occupied) & (bb.getPieces(bishop, COLOR) | queens))
+							&& !(bitboard::rookAttacks(enemyKing, occupied) & (bb.getPieces(rook, COLOR) | queens))) continue;
+					}
+					if (COUNT_ONLY) count++;
+					else moves->push_back(createMove(from, enPassantTarget, enPassantMove));
+				}
+			}
+			return count;
+		}
+
+		template <GenerationType TYPE>
+		void computeLegalMoves(const bitboard::Bitboards& bb, bool color, int8_t enPassantTarget, const std::array<bool, 4>& castlingAvailability,
+			MoveList& moves, const bitboard::Bitboard* enemyAttacks = nullptr) {
+			if (color) generateLegalMoves<true, TYPE, false>(bb, enPassantTarget, castlingAvailability, &moves, enemyAttacks);
+			else generateLegalMoves<false, TYPE, false>(bb, enPassantTarget, castlingAvailability, &moves, enemyAttacks);
+		}
+
+		// NOT including castling
+		void computeLegalMoves_Simple(const bitboard::Bitboards& bb, bool color, int8_t enPassantTarget, MoveList& moves) {
+			computeLegalMoves<allMoves>(bb, color, enPassantTarget, NO_CASTLING, moves);
 		}
 
+		// includes castling
+		void computeLegalMoves_Full(const bitboard::Bitboards& bb, bool color, int8_t enPassantTarget, const std::array<bool, 4>& castlingAvailability, MoveList& moves) {
+			computeLegalMoves<allMoves>(bb, color, enPassantTarget, castlingAvailability, moves);
+		}
 
+		size_t countLegalMoves_Full(const bitboard::Bitboards& bb, bool color, int8_t enPassantTarget, const std::array<bool, 4>& castlingAvailability) {
+			return color ? generateLegalMoves<true, allMoves, true>(bb, enPassantTarget, castlingAvailability, nullptr)
+				: generateLegalMoves<false, allMoves, true>(bb, enPassantTarget, castlingAvailability, nullptr);
+		}
 
-		// // includes castling
-		// std::vector<std::pair<int8_t, int8_t>> computeLegalMoves_Full(const std::array<SquareId, 64>& board, const bool color, const int8_t enPassantTarget, const std::array<bool, 4>& castlingAvailability) {
-		// 	std::vector<std::pair<int8_t, int8_t>> res = computeLegalMoves_Simple(board, color, enPassantTarget);
-		// 	std::vector<std::pair<int8_t, int8_t>> res2 = computeCastlingMoves(board, color, castlingAvailability);
-		// 	res.insert(res.end(), res2.begin(), res2.end());
-		// 	return res;
-		// }
-
-		// std::vector<std::pair<int8_t, int8_t>> computeCastlingMoves(const std::array<SquareId, 64>& board, const bool color, const std::array<bool, 4>& castlingAvailability) {  //TODO
-		// 	std::vector<std::pair<int8_t, int8_t>> res;
-		// 	if (castlingAvailability[0] || castlingAvailability[1] || castlingAvailability[2] || castlingAvailability[3]) {
-		// 		return res;
-		// 	}
-		// 	if (!isKingAttacked(board, color)) {
-		// 		if (color) {  //white
-		// 			if (board[60] == wking) {
-		// 				if (board[61] == empty && board[62] == empty) {  // kingside castle
-		// 					std::array<SquareId, 64> boardCopy = board;
-		// 					boardCopy[61] = boardCopy[60];
-		// 					boardCopy[60] = empty;
-
-		// 				}
-		// 				if () {  // queenside castle
-
-		// 				}
-		// 			}
-		// 		} else {  // black
-		// 			if (board[4] == bking) {
-		// 				if () {  // kingside castle
-
-		// 				}
-		// 				if () {  // queenside castle
-
-		// 				}
-		// 			}
-		// 		}
-		// 	}
-		// 	return res;
-		// }
+		void computeLegalMoves_Simple(const std::array<SquareId, 64>& board, bool color, int8_t enPassantTarget, MoveList& moves) {
+			CHESS_STATS_COUNT(boardCopies);
+			computeLegalMoves_Simple(bitboard::Bitboards(board), color, enPassantTarget, moves);
+		}
 
 	}
 
 	namespace convert {
 
 		const char squareIdChars[] = { '1', 'P', 'p', 'N', 'n', 'B', 'b', 'R', 'r', 'Q', 'q', 'K', 'k' };
-		const char fenAllowedCharsPart1[] = { '/', '1', '2', '3', '4', '5', '6', '7', '8', 'P', 'p', 'N', 'n', 'B', 'b', 'R', 'r', 'Q', 'q', 'K', 'k' };
 
 		
 
@@ -415,51 +1042,57 @@ namespace chess {
 			return s;
 		}
 
-		std::array<SquareId, 64> computeBoardFromFenPart(std::string fen) {
+		inline int8_t computeSquareIdFromChar(char c) {  // -1 if c is not a piece letter
+			switch (c) {
+				case 'P': return wpawn;
+				case 'p': return bpawn;
+				case 'N': return wknight;
+				case 'n': return bknight;
+				case 'B': return wbishop;
+				case 'b': return bbishop;
+				case 'R': return wrook;
+				case 'r': return brook;
+				case 'Q': return wqueen;
+				case 'q': return bqueen;
+				case 'K': return wking;
+				case 'k': return bking;
+				default: return -1;
+			}
+		}
+
+		// single pass over the placement field, nothing is allocated
+		void computeBoardFromFenPart(std::string_view fen, std::array<SquareId, 64>& board) {
 			if (fen.length() > 71) {
 				throw "fen too long";
 			}
 			if (fen.length() < 15) {
 				throw "fen too short";
 			}
-			int8_t slashCount = 0;
-			std::vector<std::string> vec(8);
+			int8_t pos = 0;
+			int8_t rowEnd = 8;  // first square of the next row
 			for (char c : fen) {
-				if (std::find(std::begin(fenAllowedCharsPart1), std::end(fenAllowedCharsPart1), c) == std::end(fenAllowedCharsPart1)) {
-					throw "fen part not valid";
-				}
 				if (c == '/') {
-					if (slashCount == 7) {
-						throw "invalid slashcount";
-					}
-					slashCount++;
+					if (pos != rowEnd) throw "bad count in fen";
+					if (rowEnd == 64) throw "invalid slashcount";
+					rowEnd += 8;
+				} else if ('1' <= c && c <= '8') {
+					if (pos + (c - '0') > rowEnd) throw "bad count in fen";
+					std::fill_n(board.begin() + pos, c - '0', empty);
+					pos += c - '0';
 				} else {
-					vec[slashCount] += c;
-				}
-			}
-			if (slashCount != 7) {
-				throw "invalid slashcount";
-			}
-			std::string fenRedone;
-			for (std::string str : vec) {
-				int8_t count = 0;
-				for (char c : str) {
-					if (49 <= c && c <= 57) {  // is number 1-8
-						count += c - 48;
-						fenRedone += std::string(c - 48, '1');
-					} else {
-						count += 1;
-						fenRedone += c;
-					}
-				}
-				if (count != 8) {
-					throw "bad count in fen";
+					int8_t id = computeSquareIdFromChar(c);
+					if (id == -1) throw "fen part not valid";
+					if (pos == rowEnd) throw "bad count in fen";
+					board[pos++] = SquareId(id);
 				}
 			}
-			std::array<SquareId, 64> ret;
-			for (int8_t i = 0; i < 64; i++) {
-				ret[i] = chess::SquareId(std::find(squareIdChars, std::end(squareIdChars), fenRedone[i]) - squareIdChars);
-			}
+			if (rowEnd != 64) throw "invalid slashcount";
+			if (pos != 64) throw "bad count in fen";
+		}
+
+		std::array<SquareId, 64> computeBoardFromFenPart(std::string_view fen) {
+			std::array<SquareId, 64> ret;
+			computeBoardFromFenPart(fen, ret);
 			return ret;
 		}
 
@@ -493,20 +1126,29 @@ namespace chess {
 			if (index > 63 || index < 0) {
 				throw "index must be between 0 and 63";
 			}
-			div_t d = std::div(index, 8);
-			return std::string{boardColumns[d.rem], boardRows[d.quot]};
+			return std::string{boardColumns[bitboard::getColumn(index)], boardRows[bitboard::getRow(index)]};
+		}
+
+		std::string computeMoveToString(Move move) {  // e2e4, e7e8q
+			std::string s = getCoordsFromIndex(getMoveFrom(move)) + getCoordsFromIndex(getMoveTo(move));
+			if (getMoveFlag(move) == promotionMove) s += squareIdChars[getSquareId(getMovePromotion(move), false)];
+			return s;
 		}
 
-		int8_t getIndexFromCoords(std::string str) {
+		inline int8_t computeIndexFromChars(char column, char row) {  // e4 -> 36, -1 if not a square
+			if (column < 'a' || column > 'h' || row < '1' || row > '8') return -1;
+			return 8 * ('8' - row) + (column - 'a');
+		}
+
+		int8_t getIndexFromCoords(std::string_view str) {
 			if (str.length() != 2) {
 				throw "string need to be 2";
 			}
-			const auto column = std::find(boardColumns, boardColumns + 8, str[0]) - boardColumns;
-			const auto row = std::find(boardRows, boardRows + 8, str[1]) - boardRows;
-			if (row == 8 || column == 8) {
+			const int8_t index = computeIndexFromChars(str[0], str[1]);
+			if (index == -1) {
 				throw "chars not vaild";
 			}
-			return 8 * row + column;
+			return index;
 		}
 	}
 
@@ -515,117 +1157,590 @@ namespace chess {
 		enum SymmetryId	{ noTurn_noSymmetry, noTurn_verticalSymmetry, noTurn_horizontalSymmetry, noTurn_doubleSymmetry,
 			withTurn_noSymmetry, withTurn_verticalSymmetry, withTurn_horizontalSymmetry, withTurn_doubleSymmetry };
 
-		std::array<SquareId, 64> turnClockwise(const std::array<SquareId, 64>& board) {
+		// ids are bit coded: 1 mirrors the columns (a <-> h), 2 mirrors the rows (8 <-> 1), 4 turns clockwise first
+
+		inline bitboard::Bitboard mirrorColumns(bitboard::Bitboard b) {  // reverses the bits of every byte
+			b = ((b >> 1) & 0x5555555555555555ULL) | ((b & 0x5555555555555555ULL) << 1);
+			b = ((b >> 2) & 0x3333333333333333ULL) | ((b & 0x3333333333333333ULL) << 2);
+			return ((b >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((b & 0x0F0F0F0F0F0F0F0FULL) << 4);
+		}
+
+		inline bitboard::Bitboard mirrorRows(bitboard::Bitboard b) {
+			return __builtin_bswap64(b);
+		}
+
+		inline bitboard::Bitboard transpose(bitboard::Bitboard b) {  // square 8y+x goes to 8x+y, delta swaps
+			bitboard::Bitboard t = 0x0F0F0F0F00000000ULL & (b ^ (b << 28));
+			b ^= t ^ (t >> 28);
+			t = 0x3333000033330000ULL & (b ^ (b << 14));
+			b ^= t ^ (t >> 14);
+			t = 0x5500550055005500ULL & (b ^ (b << 7));
+			return b ^ t ^ (t >> 7);
+		}
+
+		inline bitboard::Bitboard computeSymmetry(SymmetryId symId, bitboard::Bitboard b) {
+			if (symId & 4) b = mirrorColumns(transpose(b));  // turn clockwise
+			if (symId & 1) b = mirrorColumns(b);
+			if (symId & 2) b = mirrorRows(b);
+			return b;
+		}
+
+		inline int8_t computeSquareSymmetry(SymmetryId symId, int8_t pos) {
+			if (symId & 4) pos = ((pos & 7) << 3) | (7 - (pos >> 3));
+			if (symId & 1) pos ^= 7;
+			if (symId & 2) pos ^= 56;
+			return pos;
+		}
+
+		std::array<SquareId, 64> computeSymmetry(SymmetryId symId, const std::array<SquareId, 64>& board) {
+			bitboard::Bitboards bb(board);
 			std::array<SquareId, 64> retBoard = {};
-			for (int8_t pos = 0; pos < 64; pos++) {
-				if (board[pos] != empty) {
-					div_t d = std::div(pos, 8);
-					int8_t x = d.rem;
-					int8_t y = d.quot;
-					int8_t res_x = 7 - y;
-					int8_t res_y = x;
-					retBoard[res_y * 8 + res_x] = board[pos];
-				}
+			for (int8_t piece = wpawn; piece <= bking; piece++) {
+				bitboard::Bitboard b = computeSymmetry(symId, bb.pieces[piece]);
+				while (b) retBoard[bitboard::popLsb(b)] = SquareId(piece);
 			}
 			return retBoard;
 		}
 
+		std::array<SquareId, 64> turnClockwise(const std::array<SquareId, 64>& board) {
+			return computeSymmetry(withTurn_noSymmetry, board);
+		}
+
 		std::array<SquareId, 64> mirrorVertically(const std::array<SquareId, 64>& board) {
-			std::array<SquareId, 64> retBoard = {};
+			return computeSymmetry(noTurn_verticalSymmetry, board);
+		}
+
+		std::array<SquareId, 64> mirrorHorizontally(const std::array<SquareId, 64>& board) {
+			return computeSymmetry(noTurn_horizontalSymmetry, board);
+		}
+
+		std::array<SquareId, 64> mirrorBothWays(const std::array<SquareId, 64>& board) {
+			return computeSymmetry(noTurn_doubleSymmetry, board);
+		}
+	}
+
+	namespace zobrist {
+		// random keys xored together, the same position always gives the same key
+
+		uint64_t pieceKeys[13][64];  // [SquareId][pos], pieceKeys[empty] is unused
+		uint64_t blackToMoveKey;
+		uint64_t castlingKeys[4];  // same order as castlingAvailability
+		uint64_t enPassantKeys[8];  // by column
+		uint64_t pawnKeys[13][64];  // pieceKeys of pawns and kings, 0 for the other pieces (pawn structure key)
+
+		void init() {
+			uint64_t seed = 1070372;
+			auto random = [&]() {  // xorshift64*, fixed seed so keys are the same on every run
+				seed ^= seed >> 12, seed ^= seed << 25, seed ^= seed >> 27;
+				return seed * 2685821657736338717ULL;
+			};
+			for (int8_t piece = wpawn; piece <= bking; piece++) {
+				for (int8_t pos = 0; pos < 64; pos++) pieceKeys[piece][pos] = random();
+			}
+			blackToMoveKey = random();
+			for (uint64_t& k : castlingKeys) k = random();
+			for (uint64_t& k : enPassantKeys) k = random();
+			for (int8_t piece = wpawn; piece <= bking; piece++) {
+				const bool pawnOrKing = getPieceId(SquareId(piece)) == pawn || getPieceId(SquareId(piece)) == king;
+				for (int8_t pos = 0; pos < 64; pos++) pawnKeys[piece][pos] = pawnOrKing ? pieceKeys[piece][pos] : 0;
+			}
+		}
+
+		const bool initialized = (init(), true);
+
+		uint64_t computeCastlingKey(const std::array<bool, 4>& castlingAvailability) {
+			uint64_t key = 0;
+			for (int8_t i = 0; i < 4; i++) {
+				if (castlingAvailability[i]) key ^= castlingKeys[i];
+			}
+			return key;
+		}
+
+		// from scratch, positions keep their key up to date on every move
+		uint64_t computeKey(const std::array<SquareId, 64>& board, bool activeColor, const std::array<bool, 4>& castlingAvailability, int8_t enPassantTarget) {
+			uint64_t key = computeCastlingKey(castlingAvailability);
 			for (int8_t pos = 0; pos < 64; pos++) {
-				if (board[pos] != empty) {
-					div_t d = std::div(pos, 8);
-					int8_t x = d.rem;
-					int8_t y = d.quot;
-					int8_t res_x = 7 - x;
-					int8_t res_y = y;
-					retBoard[res_y * 8 + res_x] = board[pos];
+				if (board[pos] != empty) key ^= pieceKeys[board[pos]][pos];
+			}
+			if (!activeColor) key ^= blackToMoveKey;
+			if (enPassantTarget != -1) key ^= enPassantKeys[bitboard::getColumn(enPassantTarget)];
+			return key;
+		}
+
+		uint64_t computePawnKey(const std::array<SquareId, 64>& board) {
+			uint64_t key = 0;
+			for (int8_t pos = 0; pos < 64; pos++) key ^= pawnKeys[board[pos]][pos];
+			return key;
+		}
+	}
+
+	namespace evaluation {
+		// tapered scores: a middlegame and an endgame value, blended by the material left on the board (the phase)
+		// material and piece square values are kept up to date by the position on every move, like the zobrist key
+
+		struct Score {
+			int16_t mg = 0;
+			int16_t eg = 0;
+
+			constexpr Score() {}
+			constexpr Score(int mg, int eg) : mg(mg), eg(eg) {}
+
+			constexpr Score operator+(const Score& s) const { return Score(mg + s.mg, eg + s.eg); }
+			constexpr Score operator-(const Score& s) const { return Score(mg - s.mg, eg - s.eg); }
+			constexpr Score operator-() const { return Score(-mg, -eg); }
+			constexpr Score operator*(int n) const { return Score(mg * n, eg * n); }
+			Score& operator+=(const Score& s) { mg += s.mg; eg += s.eg; return *this; }
+			Score& operator-=(const Score& s) { mg -= s.mg; eg -= s.eg; return *this; }
+			constexpr bool operator==(const Score& s) const { return mg == s.mg && eg == s.eg; }
+			constexpr bool operator!=(const Score& s) const { return !(*this == s); }
+		};
+
+		const int8_t MAX_PHASE = 24;  // all pieces on the board, more (after promotions) counts as 24
+		constexpr int8_t PHASE_WEIGHTS[] = { 0, 1, 1, 2, 4, 0 };  // by PieceId
+
+		constexpr Score MATERIAL[] = { { 82, 94 }, { 337, 281 }, { 365, 297 }, { 477, 512 }, { 1025, 936 }, { 0, 0 } };  // by PieceId
+
+		// by PieceId, white's view with a8 first (the board layout), black reads them mirrored
+		constexpr int16_t MG_TABLES[6][64] = {
+			{ 0, 0, 0, 0, 0, 0, 0, 0,
+			98, 134, 61, 95, 68, 126, 34, -11,
+			-6, 7, 26, 31, 65, 56, 25, -20,
+			-14, 13, 6, 21, 23, 12, 17, -23,
+			-27, -2, -5, 12, 17, 6, 10, -25,
+			-26, -4, -4, -10, 3, 3, 33, -12,
+			-35, -1, -20, -23, -15, 24, 38, -22,
+			0, 0, 0, 0, 0, 0, 0, 0 },
+			{ -167, -89, -34, -49, 61, -97, -15, -107,
+			-73, -41, 72, 36, 23, 62, 7, -17,
+			-47, 60, 37, 65, 84, 129, 73, 44,
+			-9, 17, 19, 53, 37, 69, 18, 22,
+			-13, 4, 16, 13, 28, 19, 21, -8,
+			-23, -9, 12, 10, 19, 17, 25, -16,
+			-29, -53, -12, -3, -1, 18, -14, -19,
+			-105, -21, -58, -33, -17, -28, -19, -23 },
+			{ -29, 4, -82, -37, -25, -42, 7, -8,
+			-26, 16, -18, -13, 30, 59, 18, -47,
+			-16, 37, 43, 40, 35, 50, 37, -2,
+			-4, 5, 19, 50, 37, 37, 7, -2,
+			-6, 13, 13, 26, 34, 12, 10, 4,
+			0, 15, 15, 15, 14, 27, 18, 10,
+			4, 15, 16, 0, 7, 21, 33, 1,
+			-33, -3, -14, -21, -13, -12, -39, -21 },
+			{ 32, 42, 32, 51, 63, 9, 31, 43,
+			27, 32, 58, 62, 80, 67, 26, 44,
+			-5, 19, 26, 36, 17, 45, 61, 16,
+			-24, -11, 7, 26, 24, 35, -8, -20,
+			-36, -26, -12, -1, 9, -7, 6, -23,
+			-45, -25, -16, -17, 3, 0, -5, -33,
+			-44, -16, -20, -9, -1, 11, -6, -71,
+			-19, -13, 1, 17, 16, 7, -37, -26 },
+			{ -28, 0, 29, 12, 59, 44, 43, 45,
+			-24, -39, -5, 1, -16, 57, 28, 54,
+			-13, -17, 7, 8, 29, 56, 47, 57,
+			-27, -27, -16, -16, -1, 17, -2, 1,
+			-9, -26, -9, -10, -2, -4, 3, -3,
+			-14, 2, -11, -2, -5, 2, 14, 5,
+			-35, -8, 11, 2, 8, 15, -3, 1,
+			-1, -18, -9, 10, -15, -25, -31, -50 },
+			{ -65, 23, 16, -15, -56, -34, 2, 13,
+			29, -1, -20, -7, -8, -4, -38, -29,
+			-9, 24, 2, -16, -20, 6, 22, -22,
+			-17, -20, -12, -27, -30, -25, -14, -36,
+			-49, -1, -27, -39, -46, -44, -33, -51,
+			-14, -14, -22, -46, -44, -30, -15, -27,
+			1, 7, -8, -64, -43, -16, 9, 8,
+			-15, 36, 12, -54, 8, -28, 24, 14 }
+		};
+
+		constexpr int16_t EG_TABLES[6][64] = {
+			{ 0, 0, 0, 0, 0, 0, 0, 0,
+			178, 173, 158, 134, 147, 132, 165, 187,
+			94, 100, 85, 67, 56, 53, 82, 84,
+			32, 24, 13, 5, -2, 4, 17, 17,
+			13, 9, -3, -7, -7, -8, 3, -1,
+			4, 7, -6, 1, 0, -5, -1, -8,
+			13, 8, 8, 10, 13, 0, 2, -7,
+			0, 0, 0, 0, 0, 0, 0, 0 },
+			{ -58, -38, -13, -28, -31, -27, -63, -99,
+			-25, -8, -25, -2, -9, -25, -24, -52,
+			-24, -20, 10, 9, -1, -9, -19, -41,
+			-17, 3, 22, 22, 22, 11, 8, -18,
+			-18, -6, 16, 25, 16, 17, 4, -18,
+			-23, -3, -1, 15, 10, -3, -20, -22,
+			-42, -20, -10, -5, -2, -20, -23, -44,
+			-29, -51, -23, -15, -22, -18, -50, -64 },
+			{ -14, -21, -11, -8, -7, -9, -17, -24,
+			-8, -4, 7, -12, -3, -13, -4, -14,
+			2, -8, 0, -1, -2, 6, 0, 4,
+			-3, 9, 12, 9, 14, 10, 3, 2,
+			-6, 3, 13, 19, 7, 10, -3, -9,
+			-12, -3, 8, 10, 13, 3, -7, -15,
+			-14, -18, -7, -1, 4, -9, -15, -27,
+			-23, -9, -23, -5, -9, -16, -5, -17 },
+			{ 13, 10, 18, 15, 12, 12, 8, 5,
+			11, 13, 13, 11, -3, 3, 8, 3,
+			7, 7, 7, 5, 4, -3, -5, -3,
+			4, 3, 13, 1, 2, 1, -1, 2,
+			3, 5, 8, 4, -5, -6, -8, -11,
+			-4, 0, -5, -1, -7, -12, -8, -16,
+			-6, -6, 0, 2, -9, -9, -11, -3,
+			-9, 2, 3, -1, -5, -13, 4, -20 },
+			{ -9, 22, 22, 27, 27, 19, 10, 20,
+			-17, 20, 32, 41, 58, 25, 30, 0,
+			-20, 6, 9, 49, 47, 35, 19, 9,
+			3, 22, 24, 45, 57, 40, 57, 36,
+			-18, 28, 19, 47, 31, 34, 39, 23,
+			-16, -27, 15, 6, 9, 17, 10, 5,
+			-22, -23, -30, -16, -16, -23, -36, -32,
+			-33, -28, -22, -43, -5, -32, -20, -41 },
+			{ -74, -35, -18, -18, -11, 15, 4, -17,
+			-12, 17, 14, 17, 17, 38, 23, 11,
+			10, 17, 23, 15, 20, 45, 44, 13,
+			-8, 22, 24, 27, 26, 33, 26, 3,
+			-18, -4, 21, 24, 27, 23, 9, -11,
+			-19, -3, 11, 21, 23, 16, 7, -9,
+			-27, -11, 4, 13, 14, 4, -5, -17,
+			-53, -34, -21, -11, -28, -14, -24, -43 }
+		};
+
+		// material plus square value of every SquareId on every square, white positive
+		constexpr std::array<std::array<Score, 64>, 13> computePieceSquareTable() {
+			std::array<std::array<Score, 64>, 13> res = {};
+			for (int8_t piece = pawn; piece <= king; piece++) {
+				for (int8_t pos = 0; pos < 64; pos++) {
+					const Score white = MATERIAL[piece] + Score(MG_TABLES[piece][pos], EG_TABLES[piece][pos]);
+					const Score black = MATERIAL[piece] + Score(MG_TABLES[piece][pos ^ 56], EG_TABLES[piece][pos ^ 56]);
+					res[2 * piece + 1][pos] = white;
+					res[2 * piece + 2][pos] = -black;
 				}
 			}
-			return retBoard;
+			return res;
 		}
 
-		std::array<SquareId, 64> mirrorHorizontally(const std::array<SquareId, 64>& board) {
-			std::array<SquareId, 64> retBoard = {};
-			for (int8_t pos = 0; pos < 64; pos++) {
-				if (board[pos] != empty) {
-					div_t d = std::div(pos, 8);
-					int8_t x = d.rem;
-					int8_t y = d.quot;
-					int8_t res_x = x;
-					int8_t res_y = 7 - y;
-					retBoard[res_y * 8 + res_x] = board[pos];
+		constexpr std::array<std::array<Score, 64>, 13> PIECE_SQUARE = computePieceSquareTable();  // [SquareId][pos]
+
+		constexpr int8_t getPhaseWeight(SquareId piece) {
+			return piece == empty ? 0 : PHASE_WEIGHTS[(piece - 1) / 2];
+		}
+
+		// from scratch, positions keep both up to date on every move
+		Score computePieceSquareScore(const std::array<SquareId, 64>& board) {
+			Score score;
+			for (int8_t pos = 0; pos < 64; pos++) score += PIECE_SQUARE[board[pos]][pos];
+			return score;
+		}
+
+		int8_t computePhase(const std::array<SquareId, 64>& board) {
+			int8_t phase = 0;
+			for (int8_t pos = 0; pos < 64; pos++) phase += getPhaseWeight(board[pos]);
+			return phase;
+		}
+	}
+
+	namespace nnue {
+		// efficiently updatable network: king relative piece square inputs -> 2 x 256 accumulators -> 32 -> 1
+		// the first layer is a sum of weight columns, one per piece on the board (kings are only in the index), for each side:
+		// positions add and subtract columns as pieces move, a king move only invalidates the side of that king
+		// integer inference: int16 accumulators clipped to 0..127, int8 weights, int32 sums
+
+		const int PIECE_KINDS = 10;  // pawn to queen, own then enemy
+		const int FEATURE_COUNT = 64 * PIECE_KINDS * 64;  // [king square][kind][square]
+		const int HIDDEN_SIZE = 256;  // per side
+		const int L2_SIZE = 32;
+		const int WEIGHT_SHIFT = 6;  // int8 layer sums are divided by 64
+		const int OUTPUT_SCALE = 16;  // network output / 16 = centipawns
+		const int16_t CLIP = 127;
+
+		struct Network {  // views into the network file, which stays mapped while it is loaded
+			const int16_t* featureBiases;  // HIDDEN_SIZE
+			const int16_t* featureWeights;  // FEATURE_COUNT columns of HIDDEN_SIZE
+			const int32_t* hiddenBiases;  // L2_SIZE
+			const int8_t* hiddenWeights;  // L2_SIZE rows of 2 * HIDDEN_SIZE, side to move first
+			const int32_t* outputBias;  // 1
+			const int8_t* outputWeights;  // L2_SIZE
+		};
+
+		const Network* network = nullptr;  // positions only update accumulators while a network is loaded
+		uint32_t networkId = 0;  // counts loads, accumulators of an older network are stale
+
+		// seen from perspective: rows are flipped for black so both sides look at the board from their own side
+		inline int computeFeatureIndex(bool perspective, int8_t kingSquare, SquareId piece, int8_t pos) {
+			const int8_t flip = perspective ? 0 : 56;
+			const int kind = (piece - 1) / 2 + ((piece & 1) == perspective ? 0 : 5);
+			return ((kingSquare ^ flip) * PIECE_KINDS + kind) * 64 + (pos ^ flip);
+		}
+
+		namespace kernels {
+			// every path computes exactly the same integers, the fastest one the cpu supports is picked at startup
+
+			void addColumnScalar(int16_t* acc, const int16_t* column) {
+				for (int i = 0; i < HIDDEN_SIZE; i++) acc[i] += column[i];
+			}
+
+			void subColumnScalar(int16_t* acc, const int16_t* column) {
+				for (int i = 0; i < HIDDEN_SIZE; i++) acc[i] -= column[i];
+			}
+
+			int32_t dotScalar(const uint8_t* input, const int8_t* weights, int size) {  // size is a multiple of 32
+				int32_t sum = 0;
+				for (int i = 0; i < size; i++) sum += input[i] * weights[i];
+				return sum;
+			}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+			__attribute__((target("sse2"))) void addColumnSse(int16_t* acc, const int16_t* column) {
+				for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+					__m128i* a = reinterpret_cast<__m128i*>(acc + i);
+					_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i))));
 				}
 			}
-			return retBoard;
+
+			__attribute__((target("sse2"))) void subColumnSse(int16_t* acc, const int16_t* column) {
+				for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+					__m128i* a = reinterpret_cast<__m128i*>(acc + i);
+					_mm_storeu_si128(a, _mm_sub_epi16(_mm_loadu_si128(a), _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i))));
+				}
+			}
+
+			// u8 x i8 pairs summed to i16 (cannot saturate, inputs are at most 127), then to i32
+			__attribute__((target("ssse3"))) int32_t dotSse(const uint8_t* input, const int8_t* weights, int size) {
+				const __m128i ones = _mm_set1_epi16(1);
+				__m128i sum = _mm_setzero_si128();
+				for (int i = 0; i < size; i += 16) {
+					__m128i products = _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i)));
+					sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+				}
+				sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+				sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+				return _mm_cvtsi128_si32(sum);
+			}
+
+			__attribute__((target("avx2"))) void addColumnAvx2(int16_t* acc, const int16_t* column) {
+				for (int i = 0; i < HIDDEN_SIZE; i += 16) {
+					__m256i* a = reinterpret_cast<__m256i*>(acc + i);
+					_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i))));
+				}
+			}
+
+			__attribute__((target("avx2"))) void subColumnAvx2(int16_t* acc, const int16_t* column) {
+				for (int i = 0; i < HIDDEN_SIZE; i += 16) {
+					__m256i* a = reinterpret_cast<__m256i*>(acc + i);
+					_mm256_storeu_si256(a, _mm256_sub_epi16(_mm256_loadu_si256(a), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i))));
+				}
+			}
+
+			__attribute__((target("avx2"))) int32_t dotAvx2(const uint8_t* input, const int8_t* weights, int size) {
+				const __m256i ones = _mm256_set1_epi16(1);
+				__m256i sum = _mm256_setzero_si256();
+				for (int i = 0; i < size; i += 32) {
+					__m256i products = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i)),
+						_mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i)));
+					sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+				}
+				__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+				half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+				half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+				return _mm_cvtsi128_si32(half);
+			}
+#endif
+
+			struct Kernels {
+				std::string name;
+				void (*addColumn)(int16_t*, const int16_t*);
+				void (*subColumn)(int16_t*, const int16_t*);
+				int32_t (*dot)(const uint8_t*, const int8_t*, int);
+			};
+
+			std::vector<Kernels> computeSupportedKernels() {  // fastest first, scalar is always last
+				std::vector<Kernels> res;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+				if (__builtin_cpu_supports("avx2")) res.push_back({ "avx2", addColumnAvx2, subColumnAvx2, dotAvx2 });
+				if (__builtin_cpu_supports("ssse3")) res.push_back({ "sse", addColumnSse, subColumnSse, dotSse });
+#endif
+				res.push_back({ "scalar", addColumnScalar, subColumnScalar, dotScalar });
+				return res;
+			}
+
+			Kernels active = computeSupportedKernels()[0];  // may be switched to another supported one, not during a search
 		}
 
-		std::array<SquareId, 64> mirrorBothWays(const std::array<SquareId, 64>& board) {
-			std::array<SquareId, 64> retBoard = {};
-			for (int8_t pos = 0; pos < 64; pos++) {
-				if (board[pos] != empty) {
-					div_t d = std::div(pos, 8);
-					int8_t x = d.rem;
-					int8_t y = d.quot;
-					int8_t res_x = 7 - x;
-					int8_t res_y = 7 - y;
-					retBoard[res_y * 8 + res_x] = board[pos];
+		struct alignas(32) Accumulator {
+			int16_t values[2][HIDDEN_SIZE];  // [perspective], biases plus the columns of every piece
+			bool valid[2] = { false, false };
+			uint32_t networkId = 0;  // values belong to this load of a network, 0 = none
+		};
+
+		inline void addPiece(Accumulator& acc, const bitboard::Bitboards& bb, SquareId piece, int8_t pos) {
+			if (!network || acc.networkId != networkId) return;
+			for (int8_t p = 0; p < 2; p++) {
+				if (!acc.valid[p]) continue;
+				if (piece == (p ? wking : bking)) acc.valid[p] = false;
+				else if (piece != wking && piece != bking) {
+					const int index = computeFeatureIndex(p, bitboard::getLsb(bb.pieces[p ? wking : bking]), piece, pos);
+					kernels::active.addColumn(acc.values[p], network->featureWeights + size_t(index) * HIDDEN_SIZE);
 				}
 			}
-			return retBoard;
 		}
 
+		inline void removePiece(Accumulator& acc, const bitboard::Bitboards& bb, SquareId piece, int8_t pos) {
+			if (!network || acc.networkId != networkId) return;
+			for (int8_t p = 0; p < 2; p++) {
+				if (!acc.valid[p]) continue;
+				if (piece == (p ? wking : bking)) acc.valid[p] = false;
+				else if (piece != wking && piece != bking) {
+					const int index = computeFeatureIndex(p, bitboard::getLsb(bb.pieces[p ? wking : bking]), piece, pos);
+					kernels::active.subColumn(acc.values[p], network->featureWeights + size_t(index) * HIDDEN_SIZE);
+				}
+			}
+		}
 
-		// enum SymmetryId	{ noTurn_noSymmetry, noTurn_verticalSymmetry, noTurn_horizontalSymmetry, noTurn_doubleSymmetry,
-		// 	withTurn_noSymmetry, withTurn_verticalSymmetry, withTurn_horizontalSymmetry, withTurn_doubleSymmetry };
-		std::array<SquareId, 64> computeSymmetry(SymmetryId symId, const std::array<SquareId, 64>& board) {
-			switch(symId) {
-			case noTurn_noSymmetry:
-				return std::array<SquareId, 64>(board);
-			case noTurn_verticalSymmetry:
-				return mirrorVertically(board);
-			case noTurn_horizontalSymmetry:
-				return mirrorHorizontally(board);
-			case noTurn_doubleSymmetry:
-				return mirrorBothWays(board);
-			default:
-				return computeSymmetry(SymmetryId(int(symId) - 4), turnClockwise(board));
+		// from scratch, positions keep valid sides up to date on every move
+		void refresh(Accumulator& acc, const bitboard::Bitboards& bb, bool perspective) {
+			if (acc.networkId != networkId) {
+				acc.networkId = networkId;
+				acc.valid[0] = acc.valid[1] = false;
+			}
+			std::copy(network->featureBiases, network->featureBiases + HIDDEN_SIZE, acc.values[perspective]);
+			const int8_t kingSquare = bitboard::getLsb(bb.pieces[perspective ? wking : bking]);
+			for (int8_t piece = wpawn; piece <= bqueen; piece++) {
+				bitboard::Bitboard pieces = bb.pieces[piece];
+				while (pieces) {
+					const int index = computeFeatureIndex(perspective, kingSquare, SquareId(piece), bitboard::popLsb(pieces));
+					kernels::active.addColumn(acc.values[perspective], network->featureWeights + size_t(index) * HIDDEN_SIZE);
+				}
+			}
+			acc.valid[perspective] = true;
+		}
+
+		bool isInSync(const Accumulator& acc, const bitboard::Bitboards& bb) {  // debug check of the incremental values
+			if (!network || acc.networkId != networkId) return true;
+			Accumulator fresh;
+			for (int8_t p = 0; p < 2; p++) {
+				if (!acc.valid[p]) continue;
+				refresh(fresh, bb, p);
+				if (!std::equal(acc.values[p], acc.values[p] + HIDDEN_SIZE, fresh.values[p])) return false;
 			}
+			return true;
 		}
 
+		int16_t computeOutput(const Accumulator& acc, bool sideToMove) {  // centipawns, from the side to move point of view
+			alignas(32) uint8_t input[2 * HIDDEN_SIZE];
+			for (int8_t half = 0; half < 2; half++) {
+				const int16_t* values = acc.values[half ? !sideToMove : sideToMove];
+				for (int i = 0; i < HIDDEN_SIZE; i++) input[half * HIDDEN_SIZE + i] = uint8_t(std::clamp<int16_t>(values[i], 0, CLIP));
+			}
+			alignas(32) uint8_t hidden[L2_SIZE];
+			for (int j = 0; j < L2_SIZE; j++) {
+				const int32_t sum = network->hiddenBiases[j] + kernels::active.dot(input, network->hiddenWeights + j * 2 * HIDDEN_SIZE, 2 * HIDDEN_SIZE);
+				hidden[j] = uint8_t(std::clamp<int32_t>(sum >> WEIGHT_SHIFT, 0, CLIP));
+			}
+			const int32_t output = network->outputBias[0] + kernels::active.dot(hidden, network->outputWeights, L2_SIZE);
+			return int16_t(std::clamp<int32_t>(output / OUTPUT_SCALE, -30000, 30000));
+		}
 	}
 
+	struct UndoInfo {  // what makeMove cannot recompute when going back
+		SquareId captured;
+		std::array<bool, 4> castlingAvailability;
+		int8_t enPassantTarget;
+		uint8_t halfmoveClock;
+		uint64_t key;
+	};
+
 	class Position {
 		// a8 = 0, b8 = 1, ..., a7 = 8, b7 = 9, ..., h1 = 63
 		// assume position object is well initialized (aka valid position)
 		private:
-			
+			std::vector<std::pair<Move, UndoInfo>> moveHistory;  // for pushMove / popMove
+			mutable std::array<bitboard::Bitboard, 2> attackMaps;  // by color, filled on first use
+			mutable uint8_t attackMapsValid = 0;  // bit 0 = black, bit 1 = white, cleared by every move
+
+			void putPiece(SquareId piece, int8_t pos) {
+				board[pos] = piece;
+				bitboards.putPiece(piece, pos);
+				key ^= zobrist::pieceKeys[piece][pos];
+				pawnKey ^= zobrist::pawnKeys[piece][pos];
+				pieceSquareScore += evaluation::PIECE_SQUARE[piece][pos];
+				phase += evaluation::getPhaseWeight(piece);
+				nnue::addPiece(accumulator, bitboards, piece, pos);
+			}
+
+			void removePiece(int8_t pos) {
+				bitboards.removePiece(board[pos], pos);
+				key ^= zobrist::pieceKeys[board[pos]][pos];
+				pawnKey ^= zobrist::pawnKeys[board[pos]][pos];
+				pieceSquareScore -= evaluation::PIECE_SQUARE[board[pos]][pos];
+				phase -= evaluation::getPhaseWeight(board[pos]);
+				nnue::removePiece(accumulator, bitboards, board[pos], pos);
+				board[pos] = empty;
+			}
+
+			void movePiece(int8_t from, int8_t to) {
+				bitboards.movePiece(board[from], from, to);
+				key ^= zobrist::pieceKeys[board[from]][from] ^ zobrist::pieceKeys[board[from]][to];
+				pawnKey ^= zobrist::pawnKeys[board[from]][from] ^ zobrist::pawnKeys[board[from]][to];
+				pieceSquareScore += evaluation::PIECE_SQUARE[board[from]][to] - evaluation::PIECE_SQUARE[board[from]][from];
+				nnue::removePiece(accumulator, bitboards, board[from], from);
+				nnue::addPiece(accumulator, bitboards, board[from], to);
+				board[to] = board[from];
+				board[from] = empty;
+			}
+
+			void updateCastlingAvailability(int8_t pos) {  // a king or rook left (or got captured on) pos
+				switch (pos) {
+				case 63: castlingAvailability[0] = false; break;
+				case 56: castlingAvailability[1] = false; break;
+				case 60: castlingAvailability[0] = castlingAvailability[1] = false; break;
+				case 7: castlingAvailability[2] = false; break;
+				case 0: castlingAvailability[3] = false; break;
+				case 4: castlingAvailability[2] = castlingAvailability[3] = false; break;
+				}
+			}
+
 		public:
-			const std::array<SquareId, 64> board;
-			const bool activeColor;  // true = white, false = black
-			const std::array<bool, 4> castlingAvailability; 
+			std::array<SquareId, 64> board;
+			bool activeColor;  // true = white, false = black
+			std::array<bool, 4> castlingAvailability; 
 			// order: white kingside, white queenside, black kingside, black gueenside
-			const int8_t enPassantTarget;  // -1 if does not exist, 0-63 if it does
-			const int8_t halfmoveClock; // 0->50
-			const int16_t fullmoveNumber; // 1->inf
+			int8_t enPassantTarget;  // -1 if does not exist, 0-63 if it does
+			uint8_t halfmoveClock; // 0->MAX_HALFMOVE_CLOCK
+			int16_t fullmoveNumber; // 1->inf
+			bitboard::Bitboards bitboards;  // same pieces as board
+			uint64_t key;  // zobrist, updated by every move
+			uint64_t pawnKey;  // zobrist of the pawns and kings only, updated by every move
+			evaluation::Score pieceSquareScore;  // material and piece square values, white's view, updated by every move
+			int8_t phase;  // evaluation::PHASE_WEIGHTS of the pieces on the board, updated by every move
+			mutable nnue::Accumulator accumulator;  // filled by the first network evaluation, then updated by every move
 
 			Position(const std::array<SquareId, 64>& board, bool activeColor) : 
 			board(board), activeColor(activeColor), castlingAvailability({false, false, false, false}), enPassantTarget(-1), 
-			halfmoveClock(0), fullmoveNumber(1) {
-
+			halfmoveClock(0), fullmoveNumber(1), bitboards(board) {
+				key = computeKey();
+				pawnKey = zobrist::computePawnKey(board);
+				pieceSquareScore = evaluation::computePieceSquareScore(board);
+				phase = evaluation::computePhase(board);
 			}
 
 			Position(const std::array<SquareId, 64>& board, bool activeColor, const std::array<bool, 4>& castlingAvailability, 
-				int8_t enPassantTarget, int8_t halfmoveClock, int16_t fullmoveNumber) : 
+				int8_t enPassantTarget, uint8_t halfmoveClock, int16_t fullmoveNumber) : 
 			board(board), activeColor(activeColor), castlingAvailability(castlingAvailability), enPassantTarget(enPassantTarget), 
-			halfmoveClock(halfmoveClock), fullmoveNumber(fullmoveNumber) {
-				//TODO
-
-				// is en passant logical? (check if enemy pawn if after the square, 
-				// 	check if ally pawns are close to square, check if en passant square is empty)
-
-				// check if castling is logical (check if king on native square - e1 or e8 -, 
-				// 	if  ally rooks are on native squares, and if king pathway is out of check)
+			halfmoveClock(halfmoveClock), fullmoveNumber(fullmoveNumber), bitboards(board) {
+				// drop en passant targets no pawn can take, makeMove does the same (equal positions get equal keys)
+				if (enPassantTarget != -1 && !(bitboard::pawnAttacks[!activeColor][enPassantTarget] & bitboards.getPieces(pawn, activeColor))) {
+					this->enPassantTarget = -1;
+				}
+				// drop castling rights without the king and rook on their start squares, the generator relies on them
+				const int8_t CASTLING_SQUARES[4][2] = { { 60, 63 }, { 60, 56 }, { 4, 7 }, { 4, 0 } };
+				for (int i = 0; i < 4; i++) {
+					if (board[CASTLING_SQUARES[i][0]] != (i < 2 ? wking : bking) || board[CASTLING_SQUARES[i][1]] != (i < 2 ? wrook : brook)) {
+						this->castlingAvailability[i] = false;
+					}
+				}
+				key = computeKey();
+				pawnKey = zobrist::computePawnKey(board);
+				pieceSquareScore = evaluation::computePieceSquareScore(board);
+				phase = evaluation::computePhase(board);
 			}
 
 			~Position() {}
@@ -642,73 +1757,3571 @@ namespace chess {
 				return convert::computeBoardToString(board);
 			}
 
-			Position copy() {
+			Position copy() const {
+				CHESS_STATS_TIME(boardCopies);
 				return Position(board, activeColor, castlingAvailability, enPassantTarget, halfmoveClock, fullmoveNumber);
 			}
+
+			uint64_t computeKey() const {
+				return zobrist::computeKey(board, activeColor, castlingAvailability, enPassantTarget);
+			}
+
+			// squares attacked by color (see computeAttackedSquares), computed once per position
+			bitboard::Bitboard getAttackedSquares(bool color) const {
+				if (!(attackMapsValid & (1 << color))) {
+					attackMaps[color] = pieceMovement::computeAttackedSquares(bitboards, color);
+					attackMapsValid |= 1 << color;
+				}
+				return attackMaps[color];
+			}
+
+			bool isInCheck() const {
+				return getAttackedSquares(!activeColor) & bitboards.getPieces(king, activeColor);
+			}
+
+			std::vector<uint64_t> computeKeyHistory() const {  // keys of the positions before each pushed move, oldest first
+				std::vector<uint64_t> keys;
+				keys.reserve(moveHistory.size());
+				for (auto& p : moveHistory) keys.push_back(p.second.key);
+				return keys;
+			}
+
+			template <pieceMovement::GenerationType TYPE = pieceMovement::allMoves>
+			void computeLegalMoves(MoveList& moves) const {
+				const bitboard::Bitboard enemyAttacks = getAttackedSquares(!activeColor);
+				pieceMovement::computeLegalMoves<TYPE>(bitboards, activeColor, enPassantTarget, castlingAvailability, moves, &enemyAttacks);
+			}
+
+			// checks a move that may come from another position (hash move, killer) without generating the move list
+			bool isLegalMove(Move move) const {
+				const int8_t from = getMoveFrom(move), to = getMoveTo(move);
+				const MoveFlag flag = getMoveFlag(move);
+				const SquareId piece = board[from];
+				if (move == NULL_MOVE || piece == empty || getPieceColor(piece) != activeColor) return false;
+				if (board[to] != empty && (getPieceColor(board[to]) == activeColor || getPieceId(board[to]) == king)) return false;
+				if (flag != promotionMove && getMovePromotion(move) != knight) return false;  // not an encoding the generator makes
+				if (flag == castlingMove) {  // rare enough to ask the generator
+					if (getPieceId(piece) != king) return false;
+					MoveList moves;
+					computeLegalMoves<pieceMovement::quietMoves>(moves);
+					return std::find(moves.begin(), moves.end(), move) != moves.end();
+				}
+				const bitboard::Bitboard fromBit = bitboard::squareBit(from), toBit = bitboard::squareBit(to);
+				bitboard::Bitboard captured = toBit;
+				bitboard::Bitboard occupied = (bitboards.occupied ^ fromBit) | toBit;
+				if (getPieceId(piece) == pawn) {
+					const int8_t forward = activeColor ? -8 : 8;
+					if ((flag == promotionMove) != bool(toBit & (activeColor ? bitboard::ROW_8 : bitboard::ROW_1))) return false;
+					if (flag == enPassantMove) {
+						if (to != enPassantTarget || !(bitboard::pawnAttacks[activeColor][from] & toBit)) return false;
+						captured = bitboard::squareBit(to - forward);
+						occupied ^= captured;
+					} else if (board[to] != empty) {
+						if (!(bitboard::pawnAttacks[activeColor][from] & toBit)) return false;
+					} else if (to != from + forward) {
+						const bitboard::Bitboard startRow = activeColor ? bitboard::ROW_1 >> 8 : bitboard::ROW_8 << 8;
+						if (to != from + 2 * forward || !(fromBit & startRow) || board[from + forward] != empty) return false;
+					}
+				} else {
+					bitboard::Bitboard attacks = 0;
+					switch (getPieceId(piece)) {
+						case knight: attacks = bitboard::knightAttacks[from]; break;
+						case bishop: attacks = bitboard::bishopAttacks(from, bitboards.occupied); break;
+						case rook: attacks = bitboard::rookAttacks(from, bitboards.occupied); break;
+						case queen: attacks = bitboard::queenAttacks(from, bitboards.occupied); break;
+						default: attacks = bitboard::kingAttacks[from]; break;
+					}
+					if (flag != normalMove || !(attacks & toBit)) return false;
+				}
+				const int8_t kingSquare = getPieceId(piece) == king ? to : bitboard::getLsb(bitboards.getPieces(king, activeColor));
+				return !(pieceMovement::computeAttackers(bitboards, kingSquare, occupied) & bitboards.colors[!activeColor] & ~captured);
+			}
+
+			// plays a legal move in place, castling moves are encoded as the king move (e1g1, e1c1, ...)
+			UndoInfo makeMove(Move move) {
+				const int8_t from = getMoveFrom(move);
+				const int8_t to = getMoveTo(move);
+				const MoveFlag flag = getMoveFlag(move);
+				const bool isPawnMove = board[from] == wpawn || board[from] == bpawn;
+				attackMapsValid = 0;
+				UndoInfo undo = { board[to], castlingAvailability, enPassantTarget, halfmoveClock, key };
+
+				if (flag == enPassantMove) {
+					int8_t capturedPos = activeColor ? to + 8 : to - 8;
+					undo.captured = board[capturedPos];
+					removePiece(capturedPos);
+				} else if (undo.captured != empty) {
+					removePiece(to);
+				}
+				movePiece(from, to);
+				if (flag == promotionMove) {
+					removePiece(to);
+					putPiece(getSquareId(getMovePromotion(move), activeColor), to);
+				} else if (flag == castlingMove) {
+					if (to > from) movePiece(to + 1, to - 1);  // kingside
+					else movePiece(to - 2, to + 1);  // queenside
+				}
+				key ^= zobrist::computeCastlingKey(castlingAvailability);
+				updateCastlingAvailability(from);
+				updateCastlingAvailability(to);
+				key ^= zobrist::computeCastlingKey(castlingAvailability);
+
+				// only keep an en passant target if an enemy pawn can actually take
+				if (enPassantTarget != -1) key ^= zobrist::enPassantKeys[bitboard::getColumn(enPassantTarget)];
+				enPassantTarget = -1;
+				if (isPawnMove && (from - to == 16 || to - from == 16)) {
+					int8_t target = (from + to) / 2;
+					if (bitboard::pawnAttacks[activeColor][target] & bitboards.getPieces(pawn, !activeColor)) {
+						enPassantTarget = target;
+						key ^= zobrist::enPassantKeys[bitboard::getColumn(target)];
+					}
+				}
+				halfmoveClock = (isPawnMove || undo.captured != empty) ? 0 : std::min(halfmoveClock + 1, MAX_HALFMOVE_CLOCK);
+				if (!activeColor) fullmoveNumber++;
+				activeColor = !activeColor;
+				key ^= zobrist::blackToMoveKey;
+#ifndef NDEBUG
+				if (key != computeKey()) throw "zobrist key out of sync";
+				if (pawnKey != zobrist::computePawnKey(board)) throw "pawn key out of sync";
+				if (pieceSquareScore != evaluation::computePieceSquareScore(board) || phase != evaluation::computePhase(board)) throw "incremental evaluation out of sync";
+				if (!nnue::isInSync(accumulator, bitboards)) throw "nnue accumulator out of sync";
+#endif
+				return undo;
+			}
+
+			void unmakeMove(Move move, const UndoInfo& undo) {
+				const int8_t from = getMoveFrom(move);
+				const int8_t to = getMoveTo(move);
+				const MoveFlag flag = getMoveFlag(move);
+				attackMapsValid = 0;
+				activeColor = !activeColor;
+				if (!activeColor) fullmoveNumber--;
+
+				if (flag == promotionMove) {
+					removePiece(to);
+					putPiece(getSquareId(pawn, activeColor), to);
+				} else if (flag == castlingMove) {
+					if (to > from) movePiece(to - 1, to + 1);
+					else movePiece(to + 1, to - 2);
+				}
+				movePiece(to, from);
+				if (flag == enPassantMove) {
+					putPiece(undo.captured, activeColor ? to + 8 : to - 8);
+				} else if (undo.captured != empty) {
+					putPiece(undo.captured, to);
+				}
+				castlingAvailability = undo.castlingAvailability;
+				enPassantTarget = undo.enPassantTarget;
+				halfmoveClock = undo.halfmoveClock;
+				key = undo.key;
+			}
+
+			// same as makeMove / unmakeMove but the undo info is kept by the position (game history)
+			void pushMove(Move move) {
+				moveHistory.push_back(std::pair<Move, UndoInfo>(move, makeMove(move)));
+			}
+
+			void popMove() {
+				if (moveHistory.empty()) throw "no move to pop";
+				unmakeMove(moveHistory.back().first, moveHistory.back().second);
+				moveHistory.pop_back();
+			}
 			// std::vector<int8_t> computeMovementSquaresPART(int8_t pos) { //TODO
 			// 	// return convert::computeMovementSquares(board, pos, enPassantTarget, castlingAvailability);
 			// }
 	};
 
-}
+	namespace io {
 
+		// read only view of a whole file, memory mapped where the system allows it
+		class MappedFile {
+			const char* mapping = nullptr;
+			size_t length = 0;
+#ifdef _WIN32
+			std::vector<char> buffer;  // no mmap here, the file is read once
+#endif
 
-int run(int argc, char const *argv[]) {
-	
-	// kingFen = 8/P1Kp4/k2p4/K2P1kp1/p3kp2/3P4/2Kk1Kp1/8;
-	// chess::Position rookTest = chess::Position(chess::convert::computeBoardFromFenPart("P4r1p/2R5/1P1P2R1/r1p5/1r2r1p1/5R2/1R6/r1Pp2PR"), true, std::array<bool, 4>(), -1, 0, 1);
-	// chess::Position bishopTest = chess::Position(chess::convert::computeBoardFromFenPart("4B2b/b1b5/5B2/1B1b2b1/5B2/2b5/1B1Bb3/6b1"), true, std::array<bool, 4>(), -1, 0, 1);
-	// chess::Position queenTest = chess::Position(chess::convert::computeBoardFromFenPart("q3q3/8/6Q1/3Q4/4q3/1q6/Q3Q3/6Q1"), true, std::array<bool, 4>(), -1, 0, 1);
-	// chess::Position knightTest = chess::Position(chess::convert::computeBoardFromFenPart("n4n1N/N1N1N3/N3n1n1/2N2N2/nN1nN2n/n7/2n1Nn2/N6N"), true, std::array<bool, 4>(), -1, 0, 1);
-	// chess::Position pawnTest = chess::Position(chess::convert::computeBoardFromFenPart("2k5/1p5p/P6p/4PpP1/3P4/2P5/2PP4/4K3"), true, std::array<bool, 4>(), chess::convert::getIndexFromCoords("f6"), 0, 1);
-	// auto movement = bishopTest.computeMovementSquaresPART(chess::convert::getIndexFromCoords("g1"));
-	// for (int i = 0; i < 1000000; i++) p1.computeMovementSquaresPART(chess::convert::getIndexFromCoords("c2"));
-	// for (auto& i : movement) {
-		// std::cout << chess::convert::getCoordsFromIndex(i) << " ";
-		// std::cout << (int) i << " ";
-	// }
-	// std::cout << std::endl;
-	
-	// std::string fen = "rnb1kbnr/ppp1pppp/8/1B1q4/8/8/PPPP1PPP/RNBQK1NR";
-	// std::vector<std::pair<int8_t, int8_t>> legalMoves = chess::pieceMovement::computeLegalMoves_Simple(chess::convert::computeBoardFromFenPart(fen), false, -1);
-	// std::cout << "Count: " << legalMoves.size() << std::endl;
-	// for (auto& p : legalMoves) {
-	// 	std::cout << "(" << chess::convert::getCoordsFromIndex(p.first) << ", " << chess::convert::getCoordsFromIndex(p.second) << ")  ";
-	// }
-	// std::cout << std::endl;
-
-	// std::cout << chess::convert::computeFenPartFromBoard(chess::symmetry::turnClockwise(chess::convert::computeBoardFromFenPart(fen))) << std::endl;
-	// std::cout << chess::convert::computeFenPartFromBoard(chess::symmetry::mirrorVertically(chess::convert::computeBoardFromFenPart(fen))) << std::endl;
-	// std::cout << chess::convert::computeFenPartFromBoard(chess::symmetry::mirrorHorizontally(chess::convert::computeBoardFromFenPart(fen))) << std::endl;
-	// std::cout << chess::convert::computeFenPartFromBoard(chess::symmetry::mirrorBothWays(chess::convert::computeBoardFromFenPart(fen))) << std::endl;
-	// for (int i = 0; i < 8; i++) {
-	// 	std::cout << chess::convert::computeFenPartFromBoard(chess::symmetry::computeSymmetry(chess::symmetry::SymmetryId(i), 
-	// 		chess::convert::computeBoardFromFenPart("8/8/8/4rk2/3Q4/3K4/8/8"))) << std::endl;
-	// }
-
-
-	std::shared_ptr<chess::Position> pos = std::shared_ptr<chess::Position>(
-		new chess::Position(chess::convert::computeBoardFromFenPart("r1bqkbnr/ppp1pppp/2n5/1B1p4/4P3/P7/1PPP1PPP/RNBQK1NR"), 0));
-	auto legalMoves = chess::pieceMovement::computeLegalMoves_Simple(pos->board, pos->activeColor, pos->enPassantTarget);
-	std::cout << legalMoves.size() << std::endl;
-	for (auto& p : legalMoves) {
-		std::cout << "(" << chess::convert::getCoordsFromIndex(p.first) << ", " << chess::convert::getCoordsFromIndex(p.second) << ")  ";
+		public:
+			explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+				std::ifstream in(path, std::ios::binary);
+				if (!in) throw "cannot open file";
+				buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+				mapping = buffer.data();
+				length = buffer.size();
+#else
+				int fd = open(path.c_str(), O_RDONLY);
+				if (fd == -1) throw "cannot open file";
+				struct stat st;
+				if (fstat(fd, &st) == -1) {
+					close(fd);
+					throw "cannot read file size";
+				}
+				length = st.st_size;
+				if (length) {
+					void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (p == MAP_FAILED) {
+						close(fd);
+						throw "cannot map file";
+					}
+					mapping = static_cast<const char*>(p);
+				}
+				close(fd);  // the mapping keeps the file alive
+#endif
+			}
+
+			~MappedFile() {
+#ifndef _WIN32
+				if (mapping) munmap(const_cast<char*>(mapping), length);
+#endif
+			}
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+
+			void adviseSequential() const {  // hint for files read once from start to end
+#ifndef _WIN32
+				if (mapping) madvise(const_cast<char*>(mapping), length, MADV_SEQUENTIAL);
+#endif
+			}
+
+			const char* data() const {
+				return mapping;
+			}
+
+			size_t size() const {
+				return length;
+			}
+
+			std::string_view view() const {
+				return std::string_view(mapping, length);
+			}
+		};
+	}
+
+	namespace nnue {
+		// network file: a 64 byte header (magic, then feature count, hidden size and l2 size as uint32), then the
+		// sections of Network in order, little endian, each one padded to 64 bytes so the mapped weights stay aligned
+
+		const char MAGIC[8] = { 'C', 'H', 'E', 'S', 'S', 'N', 'N', '1' };
+		const size_t HEADER_SIZE = 64;
+		const size_t SECTION_SIZES[] = { HIDDEN_SIZE * sizeof(int16_t), size_t(FEATURE_COUNT) * HIDDEN_SIZE * sizeof(int16_t),
+			L2_SIZE * sizeof(int32_t), L2_SIZE * 2 * HIDDEN_SIZE, sizeof(int32_t), L2_SIZE };
+
+		constexpr size_t computePadded(size_t bytes) {
+			return (bytes + 63) / 64 * 64;
+		}
+
+		size_t computeFileSize() {
+			size_t size = HEADER_SIZE;
+			for (size_t bytes : SECTION_SIZES) size += computePadded(bytes);
+			return size;
+		}
+
+		struct NetworkData {  // a network in memory, for writing files
+			std::vector<int16_t> featureBiases = std::vector<int16_t>(HIDDEN_SIZE);
+			std::vector<int16_t> featureWeights = std::vector<int16_t>(size_t(FEATURE_COUNT) * HIDDEN_SIZE);
+			std::vector<int32_t> hiddenBiases = std::vector<int32_t>(L2_SIZE);
+			std::vector<int8_t> hiddenWeights = std::vector<int8_t>(L2_SIZE * 2 * HIDDEN_SIZE);
+			int32_t outputBias = 0;
+			std::vector<int8_t> outputWeights = std::vector<int8_t>(L2_SIZE);
+		};
+
+		// material count only (1, 3, 3, 5, 9): accumulator unit 0 of each side holds its material,
+		// 16 hidden units hold the difference + 64, the output removes the offset again, a starting point for training
+		NetworkData computeMaterialNetwork() {
+			const int16_t values[] = { 1, 3, 3, 5, 9 };  // by PieceId
+			const int HIDDEN_UNITS = 16;
+			NetworkData data;
+			for (int king = 0; king < 64; king++) {
+				for (int kind = 0; kind < 5; kind++) {  // own pieces only
+					for (int pos = 0; pos < 64; pos++) data.featureWeights[size_t((king * PIECE_KINDS + kind) * 64 + pos) * HIDDEN_SIZE] = values[kind];
+				}
+			}
+			for (int j = 0; j < HIDDEN_UNITS; j++) {
+				data.hiddenWeights[j * 2 * HIDDEN_SIZE] = 1 << WEIGHT_SHIFT;
+				data.hiddenWeights[j * 2 * HIDDEN_SIZE + HIDDEN_SIZE] = -(1 << WEIGHT_SHIFT);
+				data.hiddenBiases[j] = 64 << WEIGHT_SHIFT;
+				data.outputWeights[j] = 100;
+			}
+			data.outputBias = -100 * HIDDEN_UNITS * 64;
+			return data;
+		}
+
+		void save(const NetworkData& data, const std::string& path) {
+			std::ofstream out(path, std::ios::binary);
+			if (!out) throw "cannot open network file for writing";
+			char header[HEADER_SIZE] = {};
+			std::copy(MAGIC, MAGIC + 8, header);
+			const uint32_t sizes[] = { uint32_t(FEATURE_COUNT), uint32_t(HIDDEN_SIZE), uint32_t(L2_SIZE) };
+			std::memcpy(header + 8, sizes, sizeof(sizes));
+			out.write(header, HEADER_SIZE);
+			const void* sections[] = { data.featureBiases.data(), data.featureWeights.data(), data.hiddenBiases.data(),
+				data.hiddenWeights.data(), &data.outputBias, data.outputWeights.data() };
+			const char padding[64] = {};
+			for (size_t i = 0; i < 6; i++) {
+				out.write(static_cast<const char*>(sections[i]), SECTION_SIZES[i]);
+				out.write(padding, computePadded(SECTION_SIZES[i]) - SECTION_SIZES[i]);
+			}
+			if (!out) throw "cannot write network file";
+		}
+
+		std::unique_ptr<io::MappedFile> networkFile;
+		Network loadedNetwork;
+
+		// the weights are used in place from the mapping, not while a search is running
+		void load(const std::string& path) {
+			std::unique_ptr<io::MappedFile> file(new io::MappedFile(path));
+			uint32_t sizes[3];
+			if (file->size() != computeFileSize() || !std::equal(MAGIC, MAGIC + 8, file->data())) throw "not a network file";
+			std::memcpy(sizes, file->data() + 8, sizeof(sizes));
+			if (sizes[0] != FEATURE_COUNT || sizes[1] != HIDDEN_SIZE || sizes[2] != L2_SIZE) throw "network file has another architecture";
+			const char* section = file->data() + HEADER_SIZE;
+			auto next = [&](size_t i) {
+				const char* res = section;
+				section += computePadded(SECTION_SIZES[i]);
+				return res;
+			};
+			loadedNetwork.featureBiases = reinterpret_cast<const int16_t*>(next(0));
+			loadedNetwork.featureWeights = reinterpret_cast<const int16_t*>(next(1));
+			loadedNetwork.hiddenBiases = reinterpret_cast<const int32_t*>(next(2));
+			loadedNetwork.hiddenWeights = reinterpret_cast<const int8_t*>(next(3));
+			loadedNetwork.outputBias = reinterpret_cast<const int32_t*>(next(4));
+			loadedNetwork.outputWeights = reinterpret_cast<const int8_t*>(next(5));
+			networkFile = std::move(file);
+			network = &loadedNetwork;
+			networkId++;
+		}
+
+		void unload() {
+			network = nullptr;
+			networkFile.reset();
+		}
+
+		int16_t evaluate(const Position& pos) {  // centipawns, from the side to move point of view
+			for (int8_t p = 0; p < 2; p++) {
+				if (pos.accumulator.networkId != networkId || !pos.accumulator.valid[p]) refresh(pos.accumulator, pos.bitboards, p);
+			}
+			return computeOutput(pos.accumulator, pos.activeColor);
+		}
 	}
-	// std::cout << chess::pieceMovement::isInSameLineOrDiagonal(56, 9) << std::endl;
 
-	// std::cout << << std::endl;
-	return 0;
+	namespace convert {
+
+		// FEN and EPD parsing works on string views and never allocates, a bad line throws like the rest of convert
+
+		struct EpdOperation {  // views into the parsed text
+			std::string_view opcode;
+			std::string_view operands;  // everything up to the ;, quotes kept
+		};
+
+		struct FenFields {
+			std::array<SquareId, 64> board;
+			bool activeColor;
+			std::array<bool, 4> castlingAvailability;
+			int8_t enPassantTarget;
+			uint8_t halfmoveClock;
+			int16_t fullmoveNumber;
+			static const size_t MAX_OPERATIONS = 16;
+			std::array<EpdOperation, MAX_OPERATIONS> operations;
+			size_t operationCount;
+
+			const EpdOperation* findOperation(std::string_view opcode) const {  // nullptr if missing
+				for (size_t i = 0; i < operationCount; i++) {
+					if (operations[i].opcode == opcode) return &operations[i];
+				}
+				return nullptr;
+			}
+
+			Position toPosition() const {
+				return Position(board, activeColor, castlingAvailability, enPassantTarget, halfmoveClock, fullmoveNumber);
+			}
+		};
+
+		const char* const FEN_SPACES = " \t\r";
+
+		std::string_view popField(std::string_view& text) {  // next space separated field, text keeps the rest
+			size_t begin = text.find_first_not_of(FEN_SPACES);
+			if (begin == std::string_view::npos) {
+				text = std::string_view();
+				return text;
+			}
+			text.remove_prefix(begin);
+			std::string_view field = text.substr(0, text.find_first_of(FEN_SPACES));
+			text.remove_prefix(field.size());
+			return field;
+		}
+
+		int parseNumber(std::string_view text, int min, int max, const char* error) {
+			int value = 0;
+			auto res = std::from_chars(text.data(), text.data() + text.size(), value);
+			if (res.ec != std::errc() || res.ptr != text.data() + text.size() || value < min || value > max) throw error;
+			return value;
+		}
+
+		void parseEpdOperations(std::string_view text, FenFields& fields) {  // opcode operands; opcode operands; ...
+			while (true) {
+				size_t begin = text.find_first_not_of(FEN_SPACES);
+				if (begin == std::string_view::npos) return;
+				text.remove_prefix(begin);
+				size_t end = 0;
+				bool quoted = false;  // a ; inside a string operand does not end the operation
+				while (end < text.size() && (quoted || text[end] != ';')) {
+					if (text[end] == '"') quoted = !quoted;
+					end++;
+				}
+				std::string_view operands = text.substr(0, end);
+				text.remove_prefix(std::min(end + 1, text.size()));
+				std::string_view opcode = popField(operands);
+				operands.remove_prefix(std::min(operands.find_first_not_of(FEN_SPACES), operands.size()));
+				operands = operands.substr(0, operands.find_last_not_of(FEN_SPACES) + 1);
+				if (fields.operationCount == FenFields::MAX_OPERATIONS) throw "too many epd operations";
+				fields.operations[fields.operationCount++] = { opcode, operands };
+				if (opcode == "hmvc") fields.halfmoveClock = parseNumber(operands, 0, MAX_HALFMOVE_CLOCK, "epd hmvc not valid");
+				else if (opcode == "fmvn") fields.fullmoveNumber = parseNumber(operands, 1, 32767, "epd fmvn not valid");
+			}
+		}
+
+		// the rules the move generator relies on, a position from outside (request, packed file, pgn tag) may break any of them
+		// parseFen does not run it, every place that takes a position from outside does
+		void checkPosition(const std::array<SquareId, 64>& board, const bitboard::Bitboards& bb, bool activeColor, int8_t enPassantTarget) {
+			for (bool color : { true, false }) {
+				if (bitboard::popCount(bb.getPieces(king, color)) != 1) throw "position needs one king per side";
+			}
+			if ((bb.pieces[wpawn] | bb.pieces[bpawn]) & (bitboard::ROW_1 | bitboard::ROW_8)) throw "pawn on the first or last row";
+			if (pieceMovement::isSquareAttacked(bb, !activeColor, pieceMovement::findKing(bb, !activeColor))) throw "side not to move is in check";
+			if (enPassantTarget != -1) {  // empty, on row 6 (white to move) or 3, the pawn that just passed it in front of it
+				if (bitboard::getRow(enPassantTarget) != (activeColor ? 2 : 5) || board[enPassantTarget] != empty
+					|| board[activeColor ? enPassantTarget + 8 : enPassantTarget - 8] != (activeColor ? bpawn : wpawn)) throw "en passant target not valid";
+			}
+		}
+
+		void checkPosition(const Position& pos) {  // the bitboards are already there
+			checkPosition(pos.board, pos.bitboards, pos.activeColor, pos.enPassantTarget);
+		}
+
+		void checkPosition(const FenFields& fields) {
+			checkPosition(fields.board, bitboard::Bitboards(fields.board), fields.activeColor, fields.enPassantTarget);
+		}
+
+		// FEN or EPD, missing trailing fields get their default value
+		// only the text is checked, not whether the move generator can play the position (see checkPosition)
+		void parseFen(std::string_view text, FenFields& fields) {
+			computeBoardFromFenPart(popField(text), fields.board);
+			std::string_view field = popField(text);
+			if (field.empty() || field == "w") fields.activeColor = true;
+			else if (field == "b") fields.activeColor = false;
+			else throw "fen active color not valid";
+			fields.castlingAvailability = { false, false, false, false };
+			field = popField(text);
+			if (field != "-") {
+				for (char c : field) {
+					switch (c) {
+						case 'K': fields.castlingAvailability[0] = true; break;
+						case 'Q': fields.castlingAvailability[1] = true; break;
+						case 'k': fields.castlingAvailability[2] = true; break;
+						case 'q': fields.castlingAvailability[3] = true; break;
+						default: throw "fen castling not valid";
+					}
+				}
+			}
+			field = popField(text);
+			fields.enPassantTarget = field.empty() || field == "-" ? -1 : getIndexFromCoords(field);
+			fields.halfmoveClock = 0;
+			fields.fullmoveNumber = 1;
+			fields.operationCount = 0;
+			// FEN clocks, an EPD opcode never starts with a digit
+			for (int i = 0; i < 2; i++) {
+				std::string_view rest = text;
+				field = popField(rest);
+				if (field.empty() || field[0] < '0' || field[0] > '9') break;
+				text = rest;
+				if (i == 0) fields.halfmoveClock = parseNumber(field, 0, MAX_HALFMOVE_CLOCK, "fen halfmove clock not valid");
+				else fields.fullmoveNumber = parseNumber(field, 1, 32767, "fen fullmove number not valid");
+			}
+			parseEpdOperations(text, fields);
+		}
+
+		Position computePositionFromFen(std::string_view fen) {  // checked, the command line and uci come through here
+			FenFields fields;
+			parseFen(fen, fields);
+			Position pos = fields.toPosition();
+			checkPosition(pos);
+			return pos;
+		}
+
+		std::string computeFenFromPosition(const Position& pos) {  // all six fields
+			std::string castling;
+			for (int i = 0; i < 4; i++) {
+				if (pos.castlingAvailability[i]) castling += "KQkq"[i];
+			}
+			return computeFenPartFromBoard(pos.board) + (pos.activeColor ? " w " : " b ") + (castling.empty() ? "-" : castling) + " "
+				+ (pos.enPassantTarget == -1 ? "-" : getCoordsFromIndex(pos.enPassantTarget)) + " " + std::to_string(pos.halfmoveClock)
+				+ " " + std::to_string(pos.fullmoveNumber);
+		}
+
+		struct FenFileStats {
+			uint64_t positions = 0;
+			uint64_t errors = 0;  // lines that did not parse
+		};
+
+		// the file is memory mapped and cut at line ends into one chunk per thread, every line is parsed in place
+		// blank lines and lines starting with # are skipped
+		// onPosition(fields, threadId) runs on the worker threads, the operation views live as long as the call
+		FenFileStats parseFenFile(const std::string& path, u_int threadCount, const std::function<void(const FenFields&, u_int)>& onPosition) {
+			io::MappedFile file(path);
+			file.adviseSequential();
+			const std::string_view text = file.view();
+			threadCount = std::max(threadCount, 1u);
+			std::vector<size_t> cuts(threadCount + 1, text.size());
+			cuts[0] = 0;
+			for (u_int i = 1; i < threadCount; i++) {
+				size_t cut = text.find('\n', std::max(cuts[i - 1], text.size() / threadCount * i));
+				cuts[i] = cut == std::string_view::npos ? text.size() : cut + 1;
+			}
+
+			std::atomic<uint64_t> positions(0), errors(0);
+			auto work = [&](u_int threadId) {
+				std::string_view chunk = text.substr(cuts[threadId], cuts[threadId + 1] - cuts[threadId]);
+				FenFields fields;
+				uint64_t threadPositions = 0, threadErrors = 0;
+				while (!chunk.empty()) {
+					size_t end = std::min(chunk.find('\n'), chunk.size());
+					std::string_view line = chunk.substr(0, end);
+					chunk.remove_prefix(std::min(end + 1, chunk.size()));
+					size_t first = line.find_first_not_of(FEN_SPACES);
+					if (first == std::string_view::npos || line[first] == '#') continue;
+					try {
+						parseFen(line, fields);
+						checkPosition(fields);
+					} catch (const char*) {
+						threadErrors++;
+						continue;
+					}
+					threadPositions++;
+					if (onPosition) onPosition(fields, threadId);
+				}
+				positions += threadPositions;
+				errors += threadErrors;
+			};
+			std::vector<std::thread> threads;
+			for (u_int i = 1; i < threadCount; i++) threads.emplace_back(work, i);
+			work(0);
+			for (auto& t : threads) t.join();
+
+			FenFileStats stats;
+			stats.positions = positions;
+			stats.errors = errors;
+			return stats;
+		}
+	}
+
+	namespace packed {
+		// fixed width binary positions for bulk storage: the occupancy, then the SquareId of every occupied square
+		// as a nibble (increasing square order, low nibble first), then the state fields, 32 bytes, little endian
+
+		struct PackedPosition {
+			uint64_t occupied;
+			uint64_t pieces[2];  // nibbles of the first 16 and the last 16 pieces
+			uint8_t flags;  // bit 0: white to move, bits 1-4: castlingAvailability
+			int8_t enPassantTarget;  // -1 if none
+			uint8_t halfmoveClock;
+			uint8_t reserved = 0;
+			int16_t fullmoveNumber;
+			uint16_t reserved2 = 0;
+
+			bool operator==(const PackedPosition& p) const {
+				return std::memcmp(this, &p, sizeof(PackedPosition)) == 0;
+			}
+		};
+		static_assert(sizeof(PackedPosition) == 32, "packed positions are 32 bytes");
+
+		const uint64_t NIBBLE_BITS = 0x1111111111111111ULL;  // bit 0 of every nibble
+
+
+		// with pext / pdep the 4 bits of the SquareIds are packed as 4 planes at once, the same work for any number of pieces
+		PackedPosition pack(const bitboard::Bitboards& bb, bool activeColor, const std::array<bool, 4>& castlingAvailability,
+			int8_t enPassantTarget, uint8_t halfmoveClock, int16_t fullmoveNumber) {
+			if (bitboard::popCount(bb.occupied) > 32) throw "too many pieces to pack";
+			PackedPosition p;
+			p.occupied = bb.occupied;
+			p.pieces[0] = p.pieces[1] = 0;
+#ifdef __BMI2__
+			for (int bit = 0; bit < 4; bit++) {
+				bitboard::Bitboard plane = 0;
+				for (int id = wpawn; id <= bking; id++) {
+					if (id & (1 << bit)) plane |= bb.pieces[id];
+				}
+				const uint64_t compact = _pext_u64(plane, bb.occupied);  // bit i: this bit of the i-th piece
+				p.pieces[0] |= _pdep_u64(compact, NIBBLE_BITS << bit);
+				p.pieces[1] |= _pdep_u64(compact >> 16, NIBBLE_BITS << bit);
+			}
+#else
+			for (int id = wpawn; id <= bking; id++) {
+				bitboard::Bitboard b = bb.pieces[id];
+				while (b) {
+					const int i = bitboard::popCount(bb.occupied & (bitboard::squareBit(bitboard::popLsb(b)) - 1));  // rank among the pieces
+					p.pieces[i >> 4] |= uint64_t(id) << (4 * (i & 15));
+				}
+			}
+#endif
+			p.flags = uint8_t(activeColor);
+			for (int i = 0; i < 4; i++) p.flags |= uint8_t(castlingAvailability[i]) << (i + 1);
+			p.enPassantTarget = enPassantTarget;
+			p.halfmoveClock = halfmoveClock;
+			p.fullmoveNumber = fullmoveNumber;
+			return p;
+		}
+
+		PackedPosition pack(const Position& pos) {
+			return pack(pos.bitboards, pos.activeColor, pos.castlingAvailability, pos.enPassantTarget, pos.halfmoveClock, pos.fullmoveNumber);
+		}
+
+		PackedPosition pack(const convert::FenFields& fields) {
+			return pack(bitboard::Bitboards(fields.board), fields.activeColor, fields.castlingAvailability, fields.enPassantTarget,
+				fields.halfmoveClock, fields.fullmoveNumber);
+		}
+
+		// the inverse of pack, planes are spread back onto the occupancy and every SquareId is an intersection of them
+		void unpackBitboards(const PackedPosition& p, bitboard::Bitboards& bb) {
+			if (bitboard::popCount(p.occupied) > 32) throw "bad packed position";
+#ifdef __BMI2__
+			bitboard::Bitboard planes[4];
+			for (int bit = 0; bit < 4; bit++) {
+				const uint64_t compact = _pext_u64(p.pieces[0], NIBBLE_BITS << bit) | (_pext_u64(p.pieces[1], NIBBLE_BITS << bit) << 16);
+				planes[bit] = _pdep_u64(compact, p.occupied);
+			}
+			bitboard::Bitboard valid = 0;  // squares whose nibble is a piece
+			bb.occupied = p.occupied;
+			bb.pieces[empty] = 0;
+			for (int id = wpawn; id <= bking; id++) {
+				bitboard::Bitboard b = p.occupied;
+				for (int bit = 0; bit < 4; bit++) b &= (id & (1 << bit)) ? planes[bit] : ~planes[bit];
+				bb.pieces[id] = b;
+				valid |= b;
+			}
+			if (valid != p.occupied) throw "bad packed position";
+			bb.colors[1] = planes[0];  // white SquareIds are odd
+			bb.colors[0] = p.occupied & ~planes[0];
+#else
+			bb = bitboard::Bitboards();
+			bitboard::Bitboard occupied = p.occupied;
+			for (int i = 0; occupied; i++) {
+				const uint8_t id = (p.pieces[i >> 4] >> (4 * (i & 15))) & 15;
+				if (id < wpawn || id > bking) throw "bad packed position";
+				bb.putPiece(SquareId(id), bitboard::popLsb(occupied));
+			}
+#endif
+		}
+
+		void unpackBoard(const PackedPosition& p, std::array<SquareId, 64>& board) {
+			board.fill(empty);
+			bitboard::Bitboard occupied = p.occupied;
+			for (int i = 0; occupied; i++) {
+				const uint8_t id = (p.pieces[i >> 4] >> (4 * (i & 15))) & 15;
+				if (id < wpawn || id > bking) throw "bad packed position";
+				board[bitboard::popLsb(occupied)] = SquareId(id);
+			}
+		}
+
+		Position unpack(const PackedPosition& p) {
+			std::array<SquareId, 64> board;
+			unpackBoard(p, board);
+			std::array<bool, 4> castlingAvailability;
+			for (int i = 0; i < 4; i++) castlingAvailability[i] = p.flags & (1 << (i + 1));
+			if (p.enPassantTarget < -1 || p.enPassantTarget > 63 || p.halfmoveClock > MAX_HALFMOVE_CLOCK) throw "bad packed position";
+			Position pos(board, p.flags & 1, castlingAvailability, p.enPassantTarget, p.halfmoveClock, p.fullmoveNumber);
+			convert::checkPosition(pos);
+			return pos;
+		}
+
+		// batches: independent fixed width records, no allocation per position
+		void packBatch(const Position* positions, size_t count, PackedPosition* out) {
+			for (size_t i = 0; i < count; i++) out[i] = pack(positions[i]);
+		}
+
+		void unpackBatch(const PackedPosition* packed, size_t count, std::vector<Position>& out) {
+			out.reserve(out.size() + count);
+			for (size_t i = 0; i < count; i++) out.push_back(unpack(packed[i]));
+		}
+
+		// file: the magic and the position count as uint64 (16 bytes), then the positions
+		const char MAGIC[8] = { 'C', 'H', 'E', 'S', 'S', 'P', 'K', '1' };
+		const size_t HEADER_SIZE = 16;
+
+		// positions are read in place from the mapping
+		class PackedFile {
+			io::MappedFile file;
+			const PackedPosition* positions = nullptr;
+			size_t count = 0;
+
+		public:
+			explicit PackedFile(const std::string& path) : file(path) {
+				if (file.size() < HEADER_SIZE || !std::equal(MAGIC, MAGIC + 8, file.data())) throw "not a packed position file";
+				uint64_t header;
+				std::memcpy(&header, file.data() + 8, sizeof(header));
+				if (header != (file.size() - HEADER_SIZE) / sizeof(PackedPosition) || (file.size() - HEADER_SIZE) % sizeof(PackedPosition)) {
+					throw "packed position file has a bad size";
+				}
+				count = header;
+				positions = reinterpret_cast<const PackedPosition*>(file.data() + HEADER_SIZE);
+				file.adviseSequential();
+			}
+
+			size_t size() const {
+				return count;
+			}
+
+			const PackedPosition& operator[](size_t i) const {
+				return positions[i];
+			}
+
+			const PackedPosition* begin() const {
+				return positions;
+			}
+
+			const PackedPosition* end() const {
+				return positions + count;
+			}
+		};
+
+		// appends positions, the count in the header is written by finish (readers reject a file without it)
+		class PackedFileWriter {
+			std::ofstream out;
+			uint64_t count = 0;
+
+		public:
+			explicit PackedFileWriter(const std::string& path) : out(path, std::ios::binary) {
+				if (!out) throw "cannot open packed position file for writing";
+				out.write(MAGIC, 8);
+				out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+			}
+
+			void write(const PackedPosition* positions, size_t n) {
+				out.write(reinterpret_cast<const char*>(positions), n * sizeof(PackedPosition));
+				count += n;
+			}
+
+			void finish() {
+				out.seekp(8);
+				out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+				out.close();
+				if (out.fail()) throw "cannot write packed position file";
+			}
+		};
+	}
+
+	namespace pgn {
+		// games are read in place from a memory mapped file, SAN moves are found in the legal move list of the position
+
+		struct Game {  // views into the file
+			std::string_view fen;  // the FEN tag, empty for the standard start
+			std::string_view result;  // the Result tag
+			std::string_view movetext;
+		};
+
+		struct SanMove {
+			PieceId piece = pawn;
+			int8_t to = -1;
+			int8_t fromColumn = -1;  // disambiguation, -1 if not given
+			int8_t fromRow = -1;
+			PieceId promotion = pawn;  // pawn = no promotion
+			int8_t castling = 0;  // 1 kingside, 2 queenside
+		};
+
+		inline PieceId computePieceFromSanChar(char c) {  // pawn if c is not a piece letter
+			switch (c) {
+				case 'N': return knight;
+				case 'B': return bishop;
+				case 'R': return rook;
+				case 'Q': return queen;
+				case 'K': return king;
+				default: return pawn;
+			}
+		}
+
+		// Nbd7, exd8=Q+, O-O-O, e8Q!? ... check and annotation marks are ignored
+		SanMove parseSan(std::string_view san) {
+			while (!san.empty() && (san.back() == '+' || san.back() == '#' || san.back() == '!' || san.back() == '?')) san.remove_suffix(1);
+			SanMove move;
+			if (san == "O-O" || san == "0-0") move.castling = 1;
+			else if (san == "O-O-O" || san == "0-0-0") move.castling = 2;
+			if (move.castling) return move;
+			if (san.size() < 2) throw "san move too short";
+			move.promotion = computePieceFromSanChar(san.back());
+			if (move.promotion != pawn) {
+				san.remove_suffix(1);
+				if (!san.empty() && san.back() == '=') san.remove_suffix(1);
+			}
+			move.piece = computePieceFromSanChar(san[0]);
+			if (move.piece != pawn) san.remove_prefix(1);
+			if (san.size() < 2) throw "san move too short";
+			move.to = convert::computeIndexFromChars(san[san.size() - 2], san[san.size() - 1]);
+			if (move.to == -1) throw "san target square not valid";
+			for (char c : san.substr(0, san.size() - 2)) {
+				if ('a' <= c && c <= 'h') move.fromColumn = c - 'a';
+				else if ('1' <= c && c <= '8') move.fromRow = '8' - c;
+				else if (c != 'x' && c != '-') throw "san move not valid";
+			}
+			return move;
+		}
+
+		Move computeMoveFromSan(const Position& pos, const SanMove& san) {
+			MoveList moves;
+			pos.computeLegalMoves(moves);
+			Move found = NULL_MOVE;
+			for (Move move : moves) {
+				const int8_t from = getMoveFrom(move), to = getMoveTo(move);
+				const MoveFlag flag = getMoveFlag(move);
+				if (san.castling) {
+					if (flag != castlingMove || (to > from) != (san.castling == 1)) continue;
+				} else {
+					if (to != san.to || flag == castlingMove || getPieceId(pos.board[from]) != san.piece) continue;
+					if ((san.fromColumn != -1 && bitboard::getColumn(from) != san.fromColumn) || (san.fromRow != -1 && bitboard::getRow(from) != san.fromRow)) continue;
+					if ((flag == promotionMove ? getMovePromotion(move) : pawn) != san.promotion) continue;
+				}
+				if (found != NULL_MOVE) throw "ambiguous san move";
+				found = move;
+			}
+			if (found == NULL_MOVE) throw "illegal san move";
+			return found;
+		}
+
+		Move computeMoveFromSan(const Position& pos, std::string_view san) {
+			return computeMoveFromSan(pos, parseSan(san));
+		}
+
+		inline bool isSpace(char c) {
+			return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+		}
+
+		inline bool isLineStart(std::string_view text, size_t i) {
+			return i == 0 || text[i - 1] == '\n';
+		}
+
+		inline bool isTagLine(std::string_view line) {  // [Name "value"], a [ inside a comment rarely looks like that
+			size_t i = 1;
+			while (i < line.size() && (std::isalnum(static_cast<unsigned char>(line[i])) || line[i] == '_')) i++;
+			if (i == 1 || line.empty() || line[0] != '[') return false;
+			while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) i++;
+			size_t last = line.find_last_not_of(" \t\r");
+			return i < line.size() && line[i] == '"' && last != std::string_view::npos && line[last] == ']';
+		}
+
+		// first game starting at or after i: a tag line not preceded by another tag line
+		size_t findGameStart(std::string_view text, size_t i) {
+			if (!isLineStart(text, i)) {
+				i = text.find('\n', i);
+				if (i == std::string_view::npos) return text.size();
+				i++;
+			}
+			bool previousIsTag = false;  // of the last non blank line seen
+			for (size_t lineEnd = i; lineEnd > 0;) {  // look back, text[lineEnd - 1] is a line end
+				const size_t begin = lineEnd > 1 ? text.rfind('\n', lineEnd - 2) + 1 : 0;  // npos + 1 = 0
+				const std::string_view line = text.substr(begin, lineEnd - 1 - begin);
+				if (line.find_first_not_of(" \t\r") != std::string_view::npos) {
+					previousIsTag = isTagLine(line);
+					break;
+				}
+				lineEnd = begin;
+			}
+			while (i < text.size()) {
+				const size_t end = std::min(text.find('\n', i), text.size());
+				const std::string_view line = text.substr(i, end - i);
+				if (line.find_first_not_of(" \t\r") != std::string_view::npos) {
+					const bool tag = isTagLine(line);
+					if (tag && !previousIsTag) return i;
+					previousIsTag = tag;
+				}
+				i = end + 1;
+			}
+			return text.size();
+		}
+
+		// the game at the start of text, text is moved past it
+		Game readGame(std::string_view& text) {
+			Game game;
+			size_t i = 0;
+			while (i < text.size()) {  // tag pairs
+				while (i < text.size() && isSpace(text[i])) i++;
+				if (i == text.size() || text[i] != '[') break;
+				size_t end = std::min(text.find('\n', i), text.size());
+				std::string_view line = text.substr(i, end - i);
+				size_t nameEnd = line.find_first_of(" \t\"");
+				size_t quote = line.find('"');
+				if (nameEnd != std::string_view::npos && quote != std::string_view::npos) {
+					std::string_view name = line.substr(1, nameEnd - 1);
+					size_t close = quote + 1;
+					while (close < line.size() && (line[close] != '"' || line[close - 1] == '\\')) close++;
+					std::string_view value = line.substr(quote + 1, close - quote - 1);
+					if (name == "FEN") game.fen = value;
+					else if (name == "Result") game.result = value;
+				}
+				i = end;
+			}
+			// the movetext ends with the next tag line, an escape line (%) is skipped
+			size_t end = i;
+			int braces = 0;
+			while (end < text.size()) {
+				char c = text[end];
+				if (c == '{') braces++;
+				else if (c == '}' && braces) braces--;
+				else if (!braces && isLineStart(text, end) && c == '[') break;
+				end++;
+			}
+			game.movetext = text.substr(i, end - i);
+			text.remove_prefix(end);
+			return game;
+		}
+
+		// calls onMove(san) for every move of the main line, comments, variations, nags and move numbers are skipped
+		template <typename OnMove>
+		void readMovetext(std::string_view text, OnMove onMove) {
+			size_t i = 0;
+			int variations = 0;
+			while (i < text.size()) {
+				const char c = text[i];
+				if (isSpace(c)) {
+					i++;
+				} else if (c == '{') {
+					i = std::min(text.find('}', i), text.size()) + 1;
+				} else if (c == ';' || (c == '%' && isLineStart(text, i))) {
+					i = std::min(text.find('\n', i), text.size());
+				} else if (c == '(') {
+					variations++;
+					i++;
+				} else if (c == ')') {
+					if (variations) variations--;
+					i++;
+				} else {
+					size_t end = i;
+					while (end < text.size() && !isSpace(text[end]) && text[end] != '{' && text[end] != '(' && text[end] != ')' && text[end] != ';') end++;
+					std::string_view token = text.substr(i, end - i);
+					i = end;
+					if (variations || token[0] == '$') continue;
+					if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*") return;
+					while (!token.empty() && '0' <= token[0] && token[0] <= '9' && token.find('.') != std::string_view::npos) token.remove_prefix(1);  // 12. 12... 12.e4
+					while (!token.empty() && token[0] == '.') token.remove_prefix(1);
+					if (!token.empty()) onMove(token);
+				}
+			}
+		}
+
+		struct PgnFileStats {
+			uint64_t games = 0;
+			uint64_t positions = 0;
+			uint64_t errors = 0;  // games with a bad move or FEN, their positions up to the error are kept
+		};
+
+		// every position of every game, from the first one to the one after the last move, is given to
+		// onPosition(pos, game, threadId) on the worker threads; the file is cut at game starts into chunks that
+		// the threads take in turn, chunk numbers follow the file and onChunkDone(chunk, threadId) follows the last position of one
+		PgnFileStats parsePgnFile(const std::string& path, u_int threadCount, const std::function<void(const Position&, const Game&, u_int)>& onPosition,
+			const std::function<void(size_t, u_int)>& onChunkDone = nullptr) {
+			io::MappedFile file(path);
+			file.adviseSequential();
+			const std::string_view text = file.view();
+			threadCount = std::max(threadCount, 1u);
+			const size_t chunkCount = threadCount == 1 ? 1 : std::max<size_t>(1, std::min<size_t>(threadCount * 16, text.size() >> 16));
+			std::vector<size_t> cuts(chunkCount + 1, text.size());
+			cuts[0] = 0;
+			for (size_t i = 1; i < chunkCount; i++) cuts[i] = findGameStart(text, std::max(cuts[i - 1], text.size() / chunkCount * i));
+
+			std::atomic<size_t> nextChunk(0);
+			std::atomic<uint64_t> games(0), positions(0), errors(0);
+			auto work = [&](u_int threadId) {
+				uint64_t threadGames = 0, threadPositions = 0, threadErrors = 0;
+				convert::FenFields fields;
+				for (size_t chunk; (chunk = nextChunk.fetch_add(1)) < chunkCount;) {
+					std::string_view rest = text.substr(cuts[chunk], cuts[chunk + 1] - cuts[chunk]);
+					while (true) {
+						rest.remove_prefix(std::min(rest.find_first_not_of(" \t\r\n"), rest.size()));
+						if (rest.empty()) break;
+						const Game game = readGame(rest);
+						threadGames++;
+						try {
+							convert::parseFen(game.fen.empty() ? std::string_view(START_FEN) : game.fen, fields);
+							Position pos = fields.toPosition();
+							convert::checkPosition(pos);  // a broken tag throws, the game counts as an error
+							if (onPosition) onPosition(pos, game, threadId);
+							threadPositions++;
+							readMovetext(game.movetext, [&](std::string_view san) {
+								pos.makeMove(computeMoveFromSan(pos, san));
+								if (onPosition) onPosition(pos, game, threadId);
+								threadPositions++;
+							});
+						} catch (const char*) {
+							threadErrors++;
+						}
+					}
+					if (onChunkDone) onChunkDone(chunk, threadId);
+				}
+				games += threadGames;
+				positions += threadPositions;
+				errors += threadErrors;
+			};
+			std::vector<std::thread> threads;
+			for (u_int i = 1; i < threadCount; i++) threads.emplace_back(work, i);
+			work(0);
+			for (auto& t : threads) t.join();
+
+			PgnFileStats stats;
+			stats.games = games;
+			stats.positions = positions;
+			stats.errors = errors;
+			return stats;
+		}
+
+		// all positions as a packed position file, in the order of the file
+		PgnFileStats convertPgnToPacked(const std::string& pgnPath, const std::string& packedPath, u_int threadCount) {
+			packed::PackedFileWriter writer(packedPath);
+			threadCount = std::max(threadCount, 1u);
+			std::vector<std::vector<packed::PackedPosition>> buffers(threadCount);  // the chunk each thread is on
+			std::map<size_t, std::vector<packed::PackedPosition>> finished;  // chunks waiting for an earlier one
+			size_t nextToWrite = 0;
+			std::mutex writeMutex;
+			PgnFileStats stats = parsePgnFile(pgnPath, threadCount, [&](const Position& pos, const Game&, u_int threadId) {
+				buffers[threadId].push_back(packed::pack(pos));
+			}, [&](size_t chunk, u_int threadId) {
+				std::lock_guard<std::mutex> lock(writeMutex);
+				finished[chunk].swap(buffers[threadId]);
+				for (auto it = finished.begin(); it != finished.end() && it->first == nextToWrite; it = finished.erase(it), nextToWrite++) {
+					writer.write(it->second.data(), it->second.size());
+				}
+			});
+			writer.finish();
+			return stats;
+		}
+	}
+
+	namespace symmetry {
+		// equivalent positions seen through a board symmetry share one canonical form:
+		// pawnless positions without castling rights have all 8, pawns only allow the a <-> h mirror
+		// and castling rights allow none (the mirrored king would be on d1/d8)
+
+		u_int computeValidSymmetryCount(const Position& pos) {  // the valid ones are the first SymmetryIds
+			if (pos.castlingAvailability[0] || pos.castlingAvailability[1] || pos.castlingAvailability[2] || pos.castlingAvailability[3]) return 1;
+			if (pos.bitboards.pieces[wpawn] | pos.bitboards.pieces[bpawn]) return 2;
+			return 8;
+		}
+
+		struct CanonicalForm {
+			SymmetryId symmetry;  // turns the position into the canonical one
+			std::array<bitboard::Bitboard, 13> pieces;
+			int8_t enPassantTarget;
+			uint64_t key;  // zobrist key of the canonical position
+		};
+
+		// minimal representative: smallest piece bitboards in SquareId order, then smallest en passant square
+		CanonicalForm computeCanonicalForm(const Position& pos) {
+			CanonicalForm form = { noTurn_noSymmetry, pos.bitboards.pieces, pos.enPassantTarget, pos.key };
+			const u_int symmetryCount = computeValidSymmetryCount(pos);
+			if (symmetryCount == 1) return form;
+			for (u_int s = 1; s < symmetryCount; s++) {
+				std::array<bitboard::Bitboard, 13> pieces;
+				for (int8_t piece = 0; piece <= bking; piece++) pieces[piece] = computeSymmetry(SymmetryId(s), pos.bitboards.pieces[piece]);
+				int8_t enPassantTarget = pos.enPassantTarget == -1 ? -1 : computeSquareSymmetry(SymmetryId(s), pos.enPassantTarget);
+				if (pieces < form.pieces || (pieces == form.pieces && enPassantTarget < form.enPassantTarget)) {
+					form.symmetry = SymmetryId(s);
+					form.pieces = pieces;
+					form.enPassantTarget = enPassantTarget;
+				}
+			}
+			if (form.symmetry != noTurn_noSymmetry) {  // no castling rights here
+				form.key = pos.activeColor ? 0 : zobrist::blackToMoveKey;
+				for (int8_t piece = wpawn; piece <= bking; piece++) {
+					bitboard::Bitboard b = form.pieces[piece];
+					while (b) form.key ^= zobrist::pieceKeys[piece][bitboard::popLsb(b)];
+				}
+				if (form.enPassantTarget != -1) form.key ^= zobrist::enPassantKeys[bitboard::getColumn(form.enPassantTarget)];
+			}
+			return form;
+		}
+
+		uint64_t computeCanonicalKey(const Position& pos) {
+			return computeCanonicalForm(pos).key;
+		}
+
+		Position canonicalize(const Position& pos) {
+			CanonicalForm form = computeCanonicalForm(pos);
+			if (form.symmetry == noTurn_noSymmetry) return pos.copy();
+			std::array<SquareId, 64> board = {};
+			for (int8_t piece = wpawn; piece <= bking; piece++) {
+				bitboard::Bitboard b = form.pieces[piece];
+				while (b) board[bitboard::popLsb(b)] = SquareId(piece);
+			}
+			return Position(board, pos.activeColor, pos.castlingAvailability, form.enPassantTarget, pos.halfmoveClock, pos.fullmoveNumber);
+		}
+
+		// direct mapped, one per thread: every symmetric variant of a position lands on the same entry
+		template <typename T>
+		class CanonicalCache {
+			struct Entry {
+				uint64_t key = 0;
+				bool filled = false;
+				T value = T();
+			};
+
+			std::vector<Entry> entries;
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+
+		public:
+			explicit CanonicalCache(size_t entryCount) {  // rounded down to a power of two
+				size_t size = 1;
+				while (size * 2 <= entryCount) size *= 2;
+				entries.resize(size);
+			}
+
+			bool probe(uint64_t canonicalKey, T& value) {
+				CHESS_STATS_TIME(canonicalProbes);
+				const Entry& entry = entries[canonicalKey & (entries.size() - 1)];
+				if (entry.filled && entry.key == canonicalKey) {
+					value = entry.value;
+					hits++;
+					CHESS_STATS_COUNT(canonicalHits);
+					return true;
+				}
+				misses++;
+				return false;
+			}
+
+			void store(uint64_t canonicalKey, const T& value) {  // always replaces
+				Entry& entry = entries[canonicalKey & (entries.size() - 1)];
+				entry.key = canonicalKey;
+				entry.filled = true;
+				entry.value = value;
+			}
+
+			void clear() {
+				std::fill(entries.begin(), entries.end(), Entry());
+				hits = misses = 0;
+			}
+
+			uint64_t getHits() const {
+				return hits;
+			}
+
+			uint64_t getMisses() const {
+				return misses;
+			}
+		};
+	}
+
+	namespace perft {
+
+		uint64_t perft(Position& pos, int8_t depth) {  // bulk counting: the last ply only counts the moves
+			if (depth == 0) return 1;
+			if (depth == 1) return pieceMovement::countLegalMoves_Full(pos.bitboards, pos.activeColor, pos.enPassantTarget, pos.castlingAvailability);
+			MoveList moves;
+			pos.computeLegalMoves(moves);
+			uint64_t nodes = 0;
+			for (Move move : moves) {
+				UndoInfo undo = pos.makeMove(move);
+				nodes += perft(pos, depth - 1);
+				pos.unmakeMove(move, undo);
+			}
+			return nodes;
+		}
+
+		// node count for every root move, root moves are shared between threads (each one with its own position copy)
+		std::vector<std::pair<Move, uint64_t>> divide(const Position& pos, int8_t depth, u_int threadCount) {
+			if (depth < 1) throw "divide depth must be at least 1";
+			MoveList moves;
+			pos.computeLegalMoves(moves);
+			std::vector<std::pair<Move, uint64_t>> res(moves.size());
+			std::atomic<size_t> next(0);
+			auto worker = [&]() {
+				Position threadPos = pos;
+				for (size_t i = next++; i < moves.size(); i = next++) {
+					UndoInfo undo = threadPos.makeMove(moves[i]);
+					res[i] = std::pair<Move, uint64_t>(moves[i], perft(threadPos, depth - 1));
+					threadPos.unmakeMove(moves[i], undo);
+				}
+			};
+			std::vector<std::thread> threads;
+			for (u_int t = 1; t < threadCount; t++) threads.emplace_back(worker);
+			worker();
+			for (std::thread& t : threads) t.join();
+			return res;
+		}
+
+		uint64_t perft(const Position& pos, int8_t depth, u_int threadCount) {
+			if (depth == 0) return 1;
+			uint64_t nodes = 0;
+			for (auto& p : divide(pos, depth, threadCount)) nodes += p.second;
+			return nodes;
+		}
+
+		struct PerftTest {
+			std::string fen;
+			int8_t depth;
+			uint64_t nodes;
+		};
+
+		// reference counts, the deepest entries take a few seconds on one thread
+		const PerftTest PERFT_SUITE[] = {
+			{ START_FEN, 1, 20 },
+			{ START_FEN, 2, 400 },
+			{ START_FEN, 3, 8902 },
+			{ START_FEN, 4, 197281 },
+			{ START_FEN, 5, 4865609 },
+			{ START_FEN, 6, 119060324 },
+			{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 1, 14 },
+			{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 2, 191 },
+			{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 3, 2812 },
+			{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 4, 43238 },
+			{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624 },
+			{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083 },
+			{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 1, 48 },  // castling, promotions and en passant
+			{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 2, 2039 },
+			{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 3, 97862 },
+			{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603 },
+			{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 1, 6 },  // promotions with capture, castling rights of one side
+			{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 2, 264 },
+			{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 3, 9467 },
+			{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333 },
+			{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 1, 44 },  // underpromotions and a castling king in check
+			{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 2, 1486 },
+			{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 3, 62379 },
+			{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487 },
+			{ "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 1, 46 },
+			{ "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 2, 2079 },
+			{ "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 3, 89890 },
+			{ "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594 },
+			{ "3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888 },  // en passant that uncovers the king along the row
+			{ "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527 },  // stalemate and checkmate
+		};
+
+		bool runSuite(u_int threadCount, int8_t maxDepth) {
+			bool allPassed = true;
+			uint64_t totalNodes = 0;
+			auto begin = std::chrono::high_resolution_clock::now();
+			for (const PerftTest& test : PERFT_SUITE) {
+				if (test.depth > maxDepth) continue;
+				uint64_t nodes = perft(convert::computePositionFromFen(test.fen), test.depth, threadCount);
+				totalNodes += nodes;
+				bool passed = nodes == test.nodes;
+				allPassed &= passed;
+				std::cout << (passed ? "OK     " : "FAILED ") << test.fen << " | depth " << int(test.depth) << " | " << nodes;
+				if (!passed) std::cout << " (expected " << test.nodes << ")";
+				std::cout << std::endl;
+			}
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+			std::cout << (allPassed ? "all passed" : "SOME FAILED") << " | Nodes: " << totalNodes << " | Time: " << ms << "ms | NPS: " << totalNodes * 1000 / (ms + 1) << std::endl;
+			return allPassed;
+		}
+	}
+
+	namespace evaluation {
+
+		const int16_t PIECE_VALUES[] = { 100, 320, 330, 500, 900, 0 };  // by PieceId, centipawns, for move ordering
+		const Score MOBILITY = { 2, 3 };  // per attacked square that does not hold an own piece
+		const Score KING_ZONE_ATTACK = { 6, 0 };  // per attacked square next to the enemy king
+		const Score DOUBLED_PAWN = { -8, -20 };  // per pawn with an own pawn in front of it
+		const Score ISOLATED_PAWN = { -10, -12 };  // no own pawn on a neighbouring column
+		const Score BACKWARD_PAWN = { -8, -10 };  // no own pawn beside or behind it on a neighbouring column, enemy pawns guard the square in front
+		const Score PAWN_SHIELD = { 10, 0 };  // per own pawn on the two rows in front of the king, its column and the neighbouring ones
+		const Score PASSED_PAWN[8] = { { 0, 0 }, { 5, 10 }, { 5, 15 }, { 10, 25 }, { 20, 45 }, { 35, 75 }, { 60, 120 }, { 0, 0 } };  // by rows advanced
+
+		constexpr std::array<bitboard::Bitboard, 8> computeNeighbourColumns() {
+			std::array<bitboard::Bitboard, 8> res = {};
+			for (int8_t x = 0; x < 8; x++) {
+				if (x > 0) res[x] |= bitboard::COLUMN_A << (x - 1);
+				if (x < 7) res[x] |= bitboard::COLUMN_A << (x + 1);
+			}
+			return res;
+		}
+
+		// squares in front of a pawn on its column and the neighbouring ones, no enemy pawn there means it is passed
+		constexpr std::array<bitboard::SquareTable, 2> computePassedPawnMasks() {
+			std::array<bitboard::SquareTable, 2> res = {};
+			for (int8_t color = 0; color < 2; color++) {
+				for (int8_t pos = 0; pos < 64; pos++) {
+					const int dy = color ? -1 : 1;
+					res[color][pos] = bitboard::computeRay(pos, 0, dy);
+					if (bitboard::getColumn(pos) > 0) res[color][pos] |= bitboard::computeRay(pos - 1, 0, dy);
+					if (bitboard::getColumn(pos) < 7) res[color][pos] |= bitboard::computeRay(pos + 1, 0, dy);
+				}
+			}
+			return res;
+		}
+
+		// squares beside and behind a pawn on the neighbouring columns, the own pawns that could still come up to support it
+		constexpr std::array<bitboard::SquareTable, 2> computeSupportMasks() {
+			std::array<bitboard::SquareTable, 2> res = {};
+			for (int8_t color = 0; color < 2; color++) {
+				for (int8_t pos = 0; pos < 64; pos++) {
+					const int dy = color ? 1 : -1;
+					if (bitboard::getColumn(pos) > 0) res[color][pos] |= bitboard::squareBit(pos - 1) | bitboard::computeRay(pos - 1, 0, dy);
+					if (bitboard::getColumn(pos) < 7) res[color][pos] |= bitboard::squareBit(pos + 1) | bitboard::computeRay(pos + 1, 0, dy);
+				}
+			}
+			return res;
+		}
+
+		constexpr std::array<bitboard::SquareTable, 2> computeShieldMasks() {  // by king square, see PAWN_SHIELD
+			std::array<bitboard::SquareTable, 2> res = {};
+			for (int8_t color = 0; color < 2; color++) {
+				for (int8_t pos = 0; pos < 64; pos++) {
+					const int dy = color ? -1 : 1;
+					for (int x = bitboard::getColumn(pos) - 1; x <= bitboard::getColumn(pos) + 1; x++) {
+						for (int y = bitboard::getRow(pos) + dy; y != bitboard::getRow(pos) + 3 * dy; y += dy) {
+							if (bitboard::isOnBoard(x, y)) res[color][pos] |= bitboard::squareBit(8 * y + x);
+						}
+					}
+				}
+			}
+			return res;
+		}
+
+		constexpr std::array<bitboard::Bitboard, 8> NEIGHBOUR_COLUMNS = computeNeighbourColumns();
+		constexpr std::array<bitboard::SquareTable, 2> PASSED_PAWN_MASKS = computePassedPawnMasks();  // [color][pos]
+		constexpr std::array<bitboard::SquareTable, 2> SUPPORT_MASKS = computeSupportMasks();  // [color][pos]
+		constexpr std::array<bitboard::SquareTable, 2> SHIELD_MASKS = computeShieldMasks();  // [color][king square]
+
+		Score evaluatePawns(const bitboard::Bitboards& bb) {  // white's view, pawns and kings only (see PawnTable)
+			Score score;
+			for (int8_t color = 0; color < 2; color++) {
+				const bitboard::Bitboard own = bb.getPieces(pawn, color);
+				const bitboard::Bitboard enemy = bb.getPieces(pawn, !color);
+				const bitboard::Bitboard enemyAttacks = color ? pieceMovement::computePawnAttacks<false>(enemy) : pieceMovement::computePawnAttacks<true>(enemy);
+				Score terms;
+				bitboard::Bitboard pawns = own;
+				while (pawns) {
+					const int8_t pos = bitboard::popLsb(pawns);
+					if (own & bitboard::rays[color ? 1 : 6][pos]) terms += DOUBLED_PAWN;  // kingSteps 1 and 6 are straight ahead
+					if (!(own & NEIGHBOUR_COLUMNS[bitboard::getColumn(pos)])) terms += ISOLATED_PAWN;
+					else if (!(own & SUPPORT_MASKS[color][pos]) && (enemyAttacks & bitboard::squareBit(color ? pos - 8 : pos + 8))) terms += BACKWARD_PAWN;
+					if (!(enemy & PASSED_PAWN_MASKS[color][pos])) terms += PASSED_PAWN[color ? 7 - bitboard::getRow(pos) : bitboard::getRow(pos)];
+				}
+				terms += PAWN_SHIELD * bitboard::popCount(own & SHIELD_MASKS[color][bitboard::getLsb(bb.getPieces(king, color))]);
+				score += color ? terms : -terms;
+			}
+			return score;
+		}
+
+		class PawnTable {
+			// direct mapped, one per thread: pawns and kings move far less often than the other pieces,
+			// so most positions of a search share their pawn structure with one evaluated before
+			struct Entry {
+				uint64_t key = 0;
+				Score score;
+				bool filled = false;
+			};
+
+			std::vector<Entry> entries;
+			size_t sizeMB = 0;
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+
+		public:
+			explicit PawnTable(size_t sizeMB) {
+				resize(sizeMB);
+			}
+
+			void resize(size_t sizeMB) {  // rounded down to a power of two number of entries, the entries are dropped
+				size_t count = 1;
+				while (count * 2 * sizeof(Entry) <= sizeMB * 1024 * 1024) count *= 2;
+				entries.assign(count, Entry());
+				this->sizeMB = sizeMB;
+			}
+
+			Score probe(const bitboard::Bitboards& bb, uint64_t pawnKey) {  // evaluatePawns, stored on a miss
+				CHESS_STATS_TIME(pawnProbes);
+				Entry& entry = entries[pawnKey & (entries.size() - 1)];
+				if (entry.filled && entry.key == pawnKey) {
+					hits++;
+					CHESS_STATS_COUNT(pawnHits);
+					return entry.score;
+				}
+				misses++;
+				entry.key = pawnKey;
+				entry.filled = true;
+				entry.score = evaluatePawns(bb);
+				return entry.score;
+			}
+
+			size_t getSizeMB() const {
+				return sizeMB;
+			}
+
+			uint64_t getHits() const {  // since the thread started
+				return hits;
+			}
+
+			uint64_t getMisses() const {
+				return misses;
+			}
+		};
+
+		std::atomic<size_t> pawnTableSizeMB(1);  // per thread, a change applies at the next evaluation of each thread
+
+		PawnTable& getPawnTable() {  // the one of the calling thread
+			thread_local PawnTable table(pawnTableSizeMB.load(std::memory_order_relaxed));
+			const size_t sizeMB = pawnTableSizeMB.load(std::memory_order_relaxed);
+			if (table.getSizeMB() != sizeMB) table.resize(sizeMB);
+			return table;
+		}
+
+		// both attack maps are cached on the position, the move generator of this node reads the same ones
+		Score evaluateActivity(const Position& pos) {  // mobility and king safety, white's view
+			Score score;
+			for (int8_t color = 0; color < 2; color++) {
+				const bitboard::Bitboard attacks = pos.getAttackedSquares(color);
+				const bitboard::Bitboard enemyKingZone = bitboard::kingAttacks[bitboard::getLsb(pos.bitboards.getPieces(king, !color))];
+				const Score terms = MOBILITY * bitboard::popCount(attacks & ~pos.bitboards.colors[color])
+					+ KING_ZONE_ATTACK * bitboard::popCount(attacks & enemyKingZone);
+				score += color ? terms : -terms;
+			}
+			return score;
+		}
+
+		int16_t computeTapered(const Score& score, int8_t phase) {
+			phase = std::min(phase, MAX_PHASE);
+			return int16_t((score.mg * phase + score.eg * (MAX_PHASE - phase)) / MAX_PHASE);
+		}
+
+		int16_t evaluate(const Position& pos) {  // centipawns, from the side to move point of view
+			CHESS_STATS_TIME(evaluations);
+			if (nnue::network) return nnue::evaluate(pos);
+			const Score score = pos.pieceSquareScore + getPawnTable().probe(pos.bitboards, pos.pawnKey) + evaluateActivity(pos);
+			const int16_t res = computeTapered(score, pos.phase);
+			return pos.activeColor ? res : -res;
+		}
+
+		// static exchange evaluation, centipawns won by the side to move when both sides recapture on the target square
+		// with their least valuable piece for as long as it pays, pieces behind a slider join in, pins are ignored
+		int16_t computeSee(const Position& pos, Move move) {
+			const bitboard::Bitboards& bb = pos.bitboards;
+			const int8_t from = getMoveFrom(move), to = getMoveTo(move);
+			const bitboard::Bitboard diagonals = bb.pieces[wbishop] | bb.pieces[bbishop] | bb.pieces[wqueen] | bb.pieces[bqueen];
+			const bitboard::Bitboard lines = bb.pieces[wrook] | bb.pieces[brook] | bb.pieces[wqueen] | bb.pieces[bqueen];
+			bitboard::Bitboard occupied = bb.occupied ^ bitboard::squareBit(from);
+			PieceId target = getPieceId(pos.board[from]);  // what stands on the square for the next capture
+			int16_t gain[32];
+			gain[0] = pos.board[to] != empty ? PIECE_VALUES[getPieceId(pos.board[to])] : 0;
+			if (getMoveFlag(move) == enPassantMove) {
+				gain[0] = PIECE_VALUES[pawn];
+				occupied ^= bitboard::squareBit(pos.activeColor ? to + 8 : to - 8);
+			} else if (getMoveFlag(move) == promotionMove) {
+				target = getMovePromotion(move);
+				gain[0] += PIECE_VALUES[target] - PIECE_VALUES[pawn];
+			}
+			bitboard::Bitboard attackers = pieceMovement::computeAttackers(bb, to, occupied) & occupied;
+			bool color = !pos.activeColor;
+			int depth = 0;
+			while (bitboard::Bitboard own = attackers & bb.colors[color]) {
+				int piece = pawn;
+				while (!(own & bb.getPieces(PieceId(piece), color))) piece++;
+				if (piece == king && (attackers & bb.colors[!color])) break;  // the king cannot take a defended piece
+				depth++;
+				gain[depth] = PIECE_VALUES[target] - gain[depth - 1];
+				target = PieceId(piece);
+				occupied ^= bitboard::squareBit(bitboard::getLsb(own & bb.getPieces(target, color)));
+				attackers = (attackers | (bitboard::bishopAttacks(to, occupied) & diagonals) | (bitboard::rookAttacks(to, occupied) & lines)) & occupied;
+				color = !color;
+			}
+			for (; depth > 0; depth--) gain[depth - 1] = -std::max<int16_t>(-gain[depth - 1], gain[depth]);
+			return gain[0];
+		}
+	}
+
+	namespace tablebase {
+		// retrograde endgame tables up to 5 men, one file per material signature (KRPvKR.tb) with white as the stronger side
+		// every position keeps its distance to mate in plies, plus a 2 bit win/draw/loss copy that is 4 times denser
+		// en passant is not part of the index: a position with a target is scored as the one without it plus the
+		// en passant captures, castling rights never are and positions with them are not probed
+
+		const u_int MAX_MEN = 5;
+		const uint8_t MAX_DTM = 254;  // plies, the dtm byte keeps one more
+		const char PIECE_LETTERS[] = "PNBRQK";  // by PieceId
+		const PieceId SIGNATURE_ORDER[] = { queen, rook, bishop, knight, pawn };  // order of the letters in a name
+
+		enum Wdl : int8_t { loss = -1, draw = 0, win = 1 };
+
+		struct ProbeResult {
+			Wdl wdl;
+			uint8_t dtm;  // plies to mate, 0 for draws
+		};
+
+		// dtm byte: 0 is a draw (or a position that cannot happen), otherwise plies + 1, odd plies win and even plies lose
+		inline ProbeResult decodeDtm(uint8_t value) {
+			if (!value) return { draw, 0 };
+			uint8_t plies = value - 1;
+			return { plies % 2 ? win : loss, plies };
+		}
+
+		inline ProbeResult computeParentResult(const ProbeResult& child) {  // the result of a move for the side that played it
+			if (child.wdl == draw) return { draw, 0 };
+			return { child.wdl == win ? loss : win, uint8_t(child.dtm + 1) };
+		}
+
+		inline bool isBetter(const ProbeResult& a, const ProbeResult& b) {  // for the side to move: quick wins, then draws, then long losses
+			if (a.wdl != b.wdl) return a.wdl > b.wdl;
+			return a.wdl == win ? a.dtm < b.dtm : a.dtm > b.dtm;
+		}
+
+		// white king region: a8-d8-d5 triangle without pawns (8 symmetries), columns a-d with pawns (a <-> h mirror)
+		int8_t pawnlessRegion[64];
+		int8_t pawnRegion[64];
+		int8_t pawnlessRegionSquares[10];
+		int8_t pawnRegionSquares[32];
+
+		void init() {
+			int8_t pawnless = 0, withPawns = 0;
+			for (int8_t pos = 0; pos < 64; pos++) {
+				int8_t x = pos & 7, y = pos >> 3;
+				pawnlessRegion[pos] = -1;
+				pawnRegion[pos] = -1;
+				if (x <= 3 && y <= x) {
+					pawnlessRegionSquares[pawnless] = pos;
+					pawnlessRegion[pos] = pawnless++;
+				}
+				if (x <= 3) {
+					pawnRegionSquares[withPawns] = pos;
+					pawnRegion[pos] = withPawns++;
+				}
+			}
+		}
+
+		const bool initialized = (init(), true);
+
+		uint64_t computeMaterialKey(const bitboard::Bitboards& bb) {  // 4 bits of piece count per SquareId
+			uint64_t key = 0;
+			for (int8_t piece = wpawn; piece <= bking; piece++) key |= uint64_t(bitboard::popCount(bb.pieces[piece])) << (4 * piece);
+			return key;
+		}
+
+		std::string computeSideName(const bitboard::Bitboards& bb, bool color) {  // KRP
+			std::string name = "K";
+			for (PieceId piece : SIGNATURE_ORDER) name += std::string(bitboard::popCount(bb.getPieces(piece, color)), PIECE_LETTERS[piece]);
+			return name;
+		}
+
+		bool isStrongerSide(const std::string& side, const std::string& other) {  // more men, then more material, then by letters
+			auto material = [](const std::string& s) {
+				int value = 0;
+				for (char c : s) {
+					if (c != 'K') value += evaluation::PIECE_VALUES[std::find(PIECE_LETTERS, PIECE_LETTERS + 6, c) - PIECE_LETTERS];
+				}
+				return value;
+			};
+			if (side.size() != other.size()) return side.size() > other.size();
+			if (material(side) != material(other)) return material(side) > material(other);
+			return side > other;
+		}
+
+		bitboard::Bitboards swapColors(const bitboard::Bitboards& bb) {  // black becomes white, rows are mirrored
+			bitboard::Bitboards res;
+			for (int8_t piece = wpawn; piece <= bking; piece++) res.pieces[piece % 2 ? piece + 1 : piece - 1] = symmetry::mirrorRows(bb.pieces[piece]);
+			res.colors[0] = symmetry::mirrorRows(bb.colors[1]);
+			res.colors[1] = symmetry::mirrorRows(bb.colors[0]);
+			res.occupied = symmetry::mirrorRows(bb.occupied);
+			return res;
+		}
+
+		SquareId computePieceAt(const bitboard::Bitboards& bb, int8_t pos) {
+			for (int8_t piece = wpawn; piece <= bking; piece++) {
+				if (bb.pieces[piece] & bitboard::squareBit(pos)) return SquareId(piece);
+			}
+			return empty;
+		}
+
+		struct Signature {
+			std::string name;
+			std::vector<SquareId> pieces;  // kings excluded, white ones first, equal pieces next to each other
+			bool hasPawns = false;
+			uint64_t size = 0;  // positions per side to move
+			uint64_t materialKey = 0;
+
+			explicit Signature(const std::string& text) {
+				size_t v = text.find('v');
+				if (v == std::string::npos || text[0] != 'K' || v + 1 >= text.size() || text[v + 1] != 'K') throw "bad tablebase signature";
+				bitboard::Bitboards bb;  // only used to count pieces
+				for (size_t i = 0; i < text.size(); i++) {
+					if (i == 0 || i == v || i == v + 1) continue;
+					const char* letter = std::find(PIECE_LETTERS, PIECE_LETTERS + 5, text[i]);
+					if (letter == PIECE_LETTERS + 5) throw "bad tablebase signature";
+					SquareId piece = getSquareId(PieceId(letter - PIECE_LETTERS), i < v);
+					bb.pieces[piece] |= bitboard::squareBit(bitboard::popCount(bb.pieces[piece]));
+				}
+				std::string white = computeSideName(bb, true), black = computeSideName(bb, false);
+				if (isStrongerSide(black, white)) throw "the stronger side of a tablebase signature must be white";
+				name = white + "v" + black;
+				for (bool color : { true, false }) {
+					for (PieceId piece : SIGNATURE_ORDER) {
+						for (int8_t i = 0; i < bitboard::popCount(bb.getPieces(piece, color)); i++) pieces.push_back(getSquareId(piece, color));
+					}
+				}
+				if (pieces.size() + 2 > MAX_MEN) throw "too many men for a tablebase";
+				hasPawns = bb.pieces[wpawn] || bb.pieces[bpawn];
+				size = (hasPawns ? 32 : 10) * 64;
+				for (SquareId piece : pieces) size *= computeRadix(piece);
+				materialKey = computeMaterialKey(bb) | (uint64_t(1) << (4 * wking)) | (uint64_t(1) << (4 * bking));
+			}
+
+			static uint64_t computeRadix(SquareId piece) {  // pawns never stand on the first or last row
+				return getPieceId(piece) == pawn ? 48 : 64;
+			}
+
+			u_int getMen() const {
+				return u_int(pieces.size()) + 2;
+			}
+
+			u_int getPawnCount() const {
+				return u_int(std::count(pieces.begin(), pieces.end(), wpawn) + std::count(pieces.begin(), pieces.end(), bpawn));
+			}
+		};
+
+		// white king square in the region, black king square, then every other piece, equal pieces by increasing square
+		// the smallest index over the valid symmetries is used, so all symmetric positions share one entry
+		uint64_t computeIndex(const Signature& sig, const bitboard::Bitboards& bb) {
+			const int8_t* region = sig.hasPawns ? pawnRegion : pawnlessRegion;
+			const u_int symmetryCount = sig.hasPawns ? 2 : 8;
+			const int8_t whiteKing = bitboard::getLsb(bb.pieces[wking]);
+			const int8_t blackKing = bitboard::getLsb(bb.pieces[bking]);
+			uint64_t best = UINT64_MAX;
+			for (u_int s = 0; s < symmetryCount; s++) {
+				const symmetry::SymmetryId symId = symmetry::SymmetryId(s);
+				int8_t kingIndex = region[symmetry::computeSquareSymmetry(symId, whiteKing)];
+				if (kingIndex == -1) continue;
+				uint64_t index = uint64_t(kingIndex) * 64 + symmetry::computeSquareSymmetry(symId, blackKing);
+				for (size_t i = 0; i < sig.pieces.size();) {
+					const SquareId piece = sig.pieces[i];
+					bitboard::Bitboard b = symmetry::computeSymmetry(symId, bb.pieces[piece]);
+					for (; i < sig.pieces.size() && sig.pieces[i] == piece; i++) {
+						int8_t pos = bitboard::popLsb(b);
+						index = index * Signature::computeRadix(piece) + (getPieceId(piece) == pawn ? pos - 8 : pos);
+					}
+				}
+				best = std::min(best, index);
+			}
+			return best;
+		}
+
+		bool decodeIndex(const Signature& sig, uint64_t index, bitboard::Bitboards& bb) {  // false if two pieces share a square
+			bb = bitboard::Bitboards();
+			for (size_t i = sig.pieces.size(); i-- > 0;) {
+				const uint64_t radix = Signature::computeRadix(sig.pieces[i]);
+				int8_t pos = int8_t(index % radix) + (radix == 48 ? 8 : 0);
+				index /= radix;
+				if (bb.occupied & bitboard::squareBit(pos)) return false;
+				bb.putPiece(sig.pieces[i], pos);
+			}
+			int8_t blackKing = index % 64;
+			int8_t whiteKing = (sig.hasPawns ? pawnRegionSquares : pawnlessRegionSquares)[index / 64];
+			if ((bb.occupied & bitboard::squareBit(blackKing)) || (bb.occupied & bitboard::squareBit(whiteKing)) || whiteKing == blackKing) return false;
+			bb.putPiece(bking, blackKing);
+			bb.putPiece(wking, whiteKing);
+			return true;
+		}
+
+		struct FileHeader {  // the WDL section (2 bits per position) and the DTM section follow, white to move first
+			char magic[8];
+			uint64_t positionsPerSide;
+			uint64_t wdlOffset;
+			uint64_t dtmOffset;
+			char name[32];
+		};
+
+		const char FILE_MAGIC[8] = { 'C', 'H', 'E', 'S', 'S', 'T', 'B', '1' };
+
+		class Tablebases {
+			struct Table {
+				Signature signature;
+				io::MappedFile file;
+				const uint8_t* wdl;
+				const uint8_t* dtm;
+
+				Table(const Signature& signature, const std::string& path) : signature(signature), file(path) {
+					if (file.size() < sizeof(FileHeader)) throw "tablebase file too short";
+					const FileHeader* header = reinterpret_cast<const FileHeader*>(file.data());
+					if (!std::equal(FILE_MAGIC, FILE_MAGIC + 8, header->magic) || header->positionsPerSide != signature.size
+						|| header->dtmOffset + 2 * signature.size > file.size()) throw "bad tablebase file";
+					wdl = reinterpret_cast<const uint8_t*>(file.data() + header->wdlOffset);
+					dtm = reinterpret_cast<const uint8_t*>(file.data() + header->dtmOffset);
+				}
+			};
+
+			std::vector<std::unique_ptr<Table>> tables;
+			std::map<uint64_t, const Table*> tablesByMaterial;
+			u_int maxMen = 0;
+
+			const Table* findTable(const bitboard::Bitboards& bb, bool& swapped) const {
+				auto it = tablesByMaterial.find(computeMaterialKey(bb));
+				swapped = it == tablesByMaterial.end();
+				if (swapped) it = tablesByMaterial.find(computeMaterialKey(swapColors(bb)));
+				return it == tablesByMaterial.end() ? nullptr : it->second;
+			}
+
+			// finds the entry of a position, colors swapped if black is the stronger side
+			const Table* findEntry(const bitboard::Bitboards& bb, bool activeColor, uint64_t& entry) const {
+				bool swapped;
+				const Table* table = findTable(bb, swapped);
+				if (!table) return nullptr;
+				uint64_t index = swapped ? computeIndex(table->signature, swapColors(bb)) : computeIndex(table->signature, bb);
+				entry = (activeColor != swapped ? 0 : table->signature.size) + index;
+				return table;
+			}
+
+		public:
+			// every table is only mapped, pages are read when a probe touches them
+			void add(const std::string& name, const std::string& path) {
+				tables.push_back(std::unique_ptr<Table>(new Table(Signature(name), path)));
+				tablesByMaterial[tables.back()->signature.materialKey] = tables.back().get();
+				maxMen = std::max(maxMen, tables.back()->signature.getMen());
+			}
+
+			u_int open(const std::string& directory) {  // every .tb file of the directory, returns the number of tables
+				u_int count = 0;
+				for (const auto& file : std::filesystem::directory_iterator(directory)) {
+					if (file.path().extension() != ".tb") continue;
+					add(file.path().stem().string(), file.path().string());
+					count++;
+				}
+				return count;
+			}
+
+			u_int getMaxMen() const {
+				return maxMen;
+			}
+
+			bool probeDtm(const bitboard::Bitboards& bb, bool activeColor, ProbeResult& result) const {  // false without a table
+				if (bitboard::popCount(bb.occupied) == 2) {
+					result = { draw, 0 };
+					return true;
+				}
+				uint64_t entry;
+				const Table* table = findEntry(bb, activeColor, entry);
+				if (!table) return false;
+				result = decodeDtm(table->dtm[entry]);
+				return true;
+			}
+
+			bool probeWdl(const bitboard::Bitboards& bb, bool activeColor, Wdl& result) const {
+				if (bitboard::popCount(bb.occupied) == 2) {
+					result = draw;
+					return true;
+				}
+				uint64_t entry;
+				const Table* table = findEntry(bb, activeColor, entry);
+				if (!table) return false;
+				const Wdl values[] = { draw, win, loss, draw };
+				result = values[(table->wdl[entry / 4] >> (2 * (entry % 4))) & 3];
+				return true;
+			}
+
+			// the best legal en passant capture, they change the material so the results come from smaller tables
+			// returns the number of captures, -1 if a table is missing
+			int probeEnPassant(const bitboard::Bitboards& bb, bool activeColor, int8_t enPassantTarget, ProbeResult& best) const {
+				if (enPassantTarget == -1 || !(bitboard::pawnAttacks[!activeColor][enPassantTarget] & bb.getPieces(pawn, activeColor))) return 0;
+				MoveList moves;
+				pieceMovement::computeLegalMoves_Simple(bb, activeColor, enPassantTarget, moves);
+				int count = 0;
+				for (Move move : moves) {
+					if (getMoveFlag(move) != enPassantMove) continue;
+					bitboard::Bitboards child = bb;
+					child.removePiece(getSquareId(pawn, !activeColor), activeColor ? enPassantTarget + 8 : enPassantTarget - 8);
+					child.movePiece(getSquareId(pawn, activeColor), getMoveFrom(move), enPassantTarget);
+					ProbeResult result;
+					if (!probeDtm(child, !activeColor, result)) return -1;
+					result = computeParentResult(result);
+					if (!count++ || isBetter(result, best)) best = result;
+				}
+				return count;
+			}
+
+			// the position without the target is in the index, the side to move may also take en passant
+			bool probeDtm(const bitboard::Bitboards& bb, bool activeColor, int8_t enPassantTarget, ProbeResult& result) const {
+				if (!probeDtm(bb, activeColor, result)) return false;
+				ProbeResult capture;
+				const int count = probeEnPassant(bb, activeColor, enPassantTarget, capture);
+				if (count == -1) return false;
+				if (count && isBetter(capture, result)) result = capture;
+				return true;
+			}
+
+			bool probe(const Position& pos, ProbeResult& result) const {
+				CHESS_STATS_TIME(tablebaseProbes);
+				if (u_int(bitboard::popCount(pos.bitboards.occupied)) > maxMen) return false;
+				if ((pos.bitboards.pieces[wpawn] | pos.bitboards.pieces[bpawn]) & pieceMovement::PROMOTION_ROWS) return false;  // not a legal position, the index has no square for it
+				if (pos.castlingAvailability[0] || pos.castlingAvailability[1] || pos.castlingAvailability[2] || pos.castlingAvailability[3]) return false;
+				if (!probeDtm(pos.bitboards, pos.activeColor, pos.enPassantTarget, result)) return false;
+				CHESS_STATS_COUNT(tablebaseHits);
+				return true;
+			}
+
+			std::vector<Signature> getSignatures() const {
+				std::vector<Signature> res;
+				for (const auto& table : tables) res.push_back(table->signature);
+				return res;
+			}
+		};
+
+		Tablebases tablebases;  // the ones search probes, empty until opened
+
+		bool decodeEntry(const Signature& sig, uint64_t e, bitboard::Bitboards& bb, bool& activeColor) {  // false if not a canonical legal position
+			activeColor = e < sig.size;
+			const uint64_t index = e % sig.size;
+			if (!decodeIndex(sig, index, bb) || computeIndex(sig, bb) != index) return false;
+			return !pieceMovement::isSquareAttacked(bb, !activeColor, bitboard::getLsb(bb.getPieces(king, !activeColor)));
+		}
+
+		bool computeChild(const bitboard::Bitboards& bb, bool activeColor, Move move, bitboard::Bitboards& child) {  // true if the material changes
+			const int8_t from = getMoveFrom(move), to = getMoveTo(move);
+			const SquareId piece = computePieceAt(bb, from);
+			const SquareId captured = computePieceAt(bb, to);
+			child = bb;
+			if (captured != empty) child.removePiece(captured, to);
+			child.movePiece(piece, from, to);
+			if (getMoveFlag(move) == promotionMove) {
+				child.removePiece(piece, to);
+				child.putPiece(getSquareId(getMovePromotion(move), activeColor), to);
+				return true;
+			}
+			return captured != empty;
+		}
+
+		int8_t computeEnPassantTarget(const bitboard::Bitboards& bb, bool activeColor, Move move) {  // the square a double push skips, -1 for other moves
+			const int8_t from = getMoveFrom(move), to = getMoveTo(move);
+			if (std::abs(to - from) != 16 || !(bb.getPieces(pawn, activeColor) & bitboard::squareBit(from))) return -1;
+			return int8_t((from + to) / 2);
+		}
+
+		// retrograde analysis of one signature, tables it converts into (captures, promotions) must be in subtables
+		// the position count of both sides is scanned once per ply: positions decided at that ply are
+		// finalized and their predecessors (found by moving pieces backwards) are updated:
+		// a loss makes every predecessor a win, a win removes one escape from each predecessor, no escape left is a loss
+		// symmetric positions share an entry, so escapes are counted per distinct child entry and parent entry
+		// a double push that allows an en passant capture leads to a position the index does not have, its value is the
+		// better of the entry without the target and the capture: entries with such a push are not updated by their
+		// children but decided by looking at all their moves again at every ply
+		void generate(const Signature& sig, const std::string& path, const Tablebases& subtables, u_int threadCount) {
+			const uint64_t entryCount = 2 * sig.size;  // white to move first
+			const uint8_t INVALID = 0xFF;  // in remaining, for entries that are not a canonical legal position
+			const uint8_t LOOKAHEAD = 0xFE;  // in remaining, for entries with a double push into en passant
+			std::unique_ptr<std::atomic<uint8_t>[]> values(new std::atomic<uint8_t>[entryCount]);  // dtm byte, 0 while unknown
+			std::unique_ptr<std::atomic<uint8_t>[]> remaining(new std::atomic<uint8_t>[entryCount]);  // escapes not refuted yet
+			// odd: win in that many plies, even: a loss cannot be shorter, lookahead entries: the longest capture or promotion
+			std::vector<uint8_t> scheduled(entryCount, 0);
+			threadCount = std::max(threadCount, 1u);
+
+			auto forEachEntry = [&](const std::function<void(uint64_t)>& work) {
+				std::vector<std::thread> threads;
+				for (u_int t = 0; t < threadCount; t++) {
+					threads.emplace_back([&, t]() {
+						for (uint64_t e = entryCount * t / threadCount; e < entryCount * (t + 1) / threadCount; e++) work(e);
+					});
+				}
+				for (auto& t : threads) t.join();
+			};
+			// a lookahead entry at this ply: a win if a move reaches a loss decided at the ply before, a loss once every move
+			// is a known win for the other side, the dtm byte or 0 if it is not decided yet
+			auto computeLookahead = [&](uint64_t e, u_int ply) {
+				bitboard::Bitboards bb;
+				bool activeColor;
+				decodeEntry(sig, e, bb, activeColor);
+				MoveList moves;
+				pieceMovement::computeLegalMoves_Simple(bb, activeColor, -1, moves);
+				bool allLost = true;
+				uint8_t longest = 0;
+				for (Move move : moves) {
+					bitboard::Bitboards child;
+					ProbeResult result;  // for the other side
+					bool known = true;
+					if (computeChild(bb, activeColor, move, child)) {
+						subtables.probeDtm(child, !activeColor, result);
+					} else {
+						const uint8_t value = values[(activeColor ? sig.size : 0) + computeIndex(sig, child)].load(std::memory_order_relaxed);
+						known = value && value <= ply;  // decided at an earlier ply, later values are not final yet
+						result = decodeDtm(value);
+						ProbeResult capture;
+						if (subtables.probeEnPassant(child, !activeColor, computeEnPassantTarget(bb, activeColor, move), capture)) {
+							if (known) {
+								if (isBetter(capture, result)) result = capture;
+							} else if (capture.wdl == win && capture.dtm < ply) {  // the entry can only be a longer win now
+								result = capture;
+								known = true;
+							}
+						}
+					}
+					if (!known) {
+						allLost = false;
+						continue;
+					}
+					result = computeParentResult(result);
+					if (result.wdl == win && result.dtm == ply) return uint8_t(ply + 1);
+					if (result.wdl != loss) allLost = false;
+					else longest = std::max(longest, result.dtm);
+				}
+				return uint8_t(allLost && longest == ply ? ply + 1 : 0);
+			};
+
+			std::atomic<uint8_t> maxScheduled(0);
+			forEachEntry([&](uint64_t e) {
+				values[e].store(0, std::memory_order_relaxed);
+				bitboard::Bitboards bb;
+				bool activeColor;
+				if (!decodeEntry(sig, e, bb, activeColor)) {
+					remaining[e].store(INVALID, std::memory_order_relaxed);
+					return;
+				}
+				MoveList moves;
+				pieceMovement::computeLegalMoves_Simple(bb, activeColor, -1, moves);
+				if (moves.size() == 0) {  // mate is a loss at ply 0, stalemate keeps an escape forever
+					remaining[e].store(pieceMovement::isSquareAttacked(bb, activeColor, bitboard::getLsb(bb.getPieces(king, activeColor))) ? 0 : 1, std::memory_order_relaxed);
+					return;
+				}
+				std::array<uint64_t, MoveList::MAX_MOVES> children;
+				size_t childCount = 0;
+				uint8_t bestWin = 0, lossFloor = 0, longest = 0;
+				bool drawEscape = false, lookahead = false;
+				for (Move move : moves) {
+					bitboard::Bitboards child;
+					if (!computeChild(bb, activeColor, move, child)) {
+						children[childCount++] = (activeColor ? sig.size : 0) + computeIndex(sig, child);
+						ProbeResult capture;
+						const int captureCount = subtables.probeEnPassant(child, !activeColor, computeEnPassantTarget(bb, activeColor, move), capture);
+						if (captureCount == -1) throw "missing tablebase for a capture or promotion";
+						if (captureCount) {
+							lookahead = true;
+							if (capture.wdl != draw) longest = std::max<uint8_t>(longest, capture.dtm + 1);
+						}
+						continue;
+					}
+					// material changes, the result comes from a smaller table
+					ProbeResult result;
+					if (!subtables.probeDtm(child, !activeColor, result)) throw "missing tablebase for a capture or promotion";
+					if (result.wdl == draw) drawEscape = true;
+					else if (result.wdl == loss) bestWin = bestWin ? std::min<uint8_t>(bestWin, result.dtm + 1) : result.dtm + 1;
+					else lossFloor = std::max<uint8_t>(lossFloor, result.dtm + 1);
+					if (result.wdl != draw) longest = std::max<uint8_t>(longest, result.dtm + 1);
+				}
+				std::sort(children.begin(), children.begin() + childCount);
+				childCount = std::unique(children.begin(), children.begin() + childCount) - children.begin();
+				remaining[e].store(lookahead ? LOOKAHEAD : uint8_t(childCount + drawEscape), std::memory_order_relaxed);
+				scheduled[e] = lookahead ? longest : bestWin ? bestWin : lossFloor;
+				uint8_t seen = maxScheduled.load();
+				while (scheduled[e] > seen && !maxScheduled.compare_exchange_weak(seen, scheduled[e])) {}
+			});
+
+			std::atomic<uint64_t> decided(0);
+			for (u_int ply = 0;; ply++) {
+				if (ply > MAX_DTM) throw "tablebase distance to mate too long";
+				decided = 0;
+				forEachEntry([&](uint64_t e) {
+					uint8_t value = values[e].load(std::memory_order_relaxed);
+					if (!value) {
+						const uint8_t left = remaining[e].load(std::memory_order_relaxed);
+						if (left == INVALID) return;
+						if (left == LOOKAHEAD) value = computeLookahead(e, ply);
+						else if (ply % 2 ? scheduled[e] == ply : (left == 0 && scheduled[e] % 2 == 0 && scheduled[e] <= ply)) value = uint8_t(ply + 1);
+						if (!value) return;
+						values[e].store(value, std::memory_order_relaxed);
+					}
+					if (value != ply + 1) return;
+					decided++;
+
+					// predecessors: the side that just moved takes a non capturing move back
+					bitboard::Bitboards bb;
+					bool activeColor;
+					decodeEntry(sig, e, bb, activeColor);
+					const bool mover = !activeColor;
+					const int8_t forward = mover ? -8 : 8;
+					const int8_t otherKing = bitboard::getLsb(bb.getPieces(king, activeColor));
+					std::array<uint64_t, 256> parents;
+					size_t parentCount = 0;
+					for (int8_t piece = getSquareId(pawn, mover); piece <= bking; piece += 2) {
+						bitboard::Bitboard pieces = bb.pieces[piece];
+						while (pieces) {
+							const int8_t to = bitboard::popLsb(pieces);
+							bitboard::Bitboard origins;
+							switch (getPieceId(SquareId(piece))) {
+								case pawn: {
+									origins = 0;
+									const int8_t single = to - forward;
+									if (single >= 8 && single < 56 && !(bb.occupied & bitboard::squareBit(single))) {
+										origins |= bitboard::squareBit(single);
+										const int8_t doubled = single - forward;
+										if ((mover ? to >> 3 == 4 : to >> 3 == 3) && !(bb.occupied & bitboard::squareBit(doubled))) origins |= bitboard::squareBit(doubled);
+									}
+									break;
+								}
+								case knight: origins = bitboard::knightAttacks[to]; break;
+								case bishop: origins = bitboard::bishopAttacks(to, bb.occupied); break;
+								case rook: origins = bitboard::rookAttacks(to, bb.occupied); break;
+								case queen: origins = bitboard::queenAttacks(to, bb.occupied); break;
+								default: origins = bitboard::kingAttacks[to]; break;
+							}
+							origins &= ~bb.occupied;
+							while (origins) {
+								bitboard::Bitboards parent = bb;
+								parent.movePiece(SquareId(piece), to, bitboard::popLsb(origins));
+								if (pieceMovement::isSquareAttacked(parent, activeColor, otherKing)) continue;  // the side not to move would be in check
+								parents[parentCount++] = (mover ? 0 : sig.size) + computeIndex(sig, parent);
+							}
+						}
+					}
+					std::sort(parents.begin(), parents.begin() + parentCount);
+					parentCount = std::unique(parents.begin(), parents.begin() + parentCount) - parents.begin();
+					for (size_t i = 0; i < parentCount; i++) {
+						std::atomic<uint8_t>& parentValue = values[parents[i]];
+						if (parentValue.load(std::memory_order_relaxed) || remaining[parents[i]].load(std::memory_order_relaxed) == LOOKAHEAD) continue;
+						if (ply % 2 == 0) parentValue.store(uint8_t(ply + 2), std::memory_order_relaxed);  // we lose, so they win one ply later
+						else remaining[parents[i]].fetch_sub(1, std::memory_order_relaxed);
+					}
+				});
+				if (!decided && ply >= maxScheduled) break;
+			}
+
+			// positions never decided are draws
+			FileHeader header = {};
+			std::copy(FILE_MAGIC, FILE_MAGIC + 8, header.magic);
+			header.positionsPerSide = sig.size;
+			header.wdlOffset = sizeof(FileHeader);
+			header.dtmOffset = header.wdlOffset + (entryCount + 3) / 4;
+			std::copy(sig.name.begin(), sig.name.begin() + std::min<size_t>(sig.name.size(), 31), header.name);
+			std::vector<uint8_t> wdl((entryCount + 3) / 4, 0), dtm(entryCount);
+			for (uint64_t e = 0; e < entryCount; e++) {
+				dtm[e] = values[e].load(std::memory_order_relaxed);
+				ProbeResult result = decodeDtm(dtm[e]);
+				wdl[e / 4] |= (result.wdl == win ? 1 : result.wdl == loss ? 2 : 0) << (2 * (e % 4));
+			}
+			std::ofstream out(path, std::ios::binary);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(wdl.data()), wdl.size());
+			out.write(reinterpret_cast<const char*>(dtm.data()), dtm.size());
+			if (!out) throw "cannot write tablebase file";
+		}
+
+		std::vector<Signature> computeSignatures(u_int maxMen) {  // in generation order: fewer men first, then fewer pawns
+			std::vector<Signature> res;
+			std::vector<std::string> sides = { "K" };  // every king plus up to 3 pieces, letters in signature order
+			for (size_t i = 0; i < sides.size(); i++) {
+				if (sides[i].size() == 4) continue;
+				for (PieceId piece : SIGNATURE_ORDER) {
+					const std::string& side = sides[i];
+					const char* order = "QRBNP";
+					if (side.size() > 1 && std::string(order).find(PIECE_LETTERS[piece]) < std::string(order).find(side.back())) continue;
+					sides.push_back(side + PIECE_LETTERS[piece]);
+				}
+			}
+			for (const std::string& white : sides) {
+				for (const std::string& black : sides) {
+					if (white.size() + black.size() < 3 || white.size() + black.size() > maxMen || isStrongerSide(black, white)) continue;
+					res.push_back(Signature(white + "v" + black));
+				}
+			}
+			std::stable_sort(res.begin(), res.end(), [](const Signature& a, const Signature& b) {
+				return a.getMen() != b.getMen() ? a.getMen() < b.getMen() : a.getPawnCount() < b.getPawnCount();
+			});
+			return res;
+		}
+
+		// tables already in the directory are kept, so an interrupted run can go on
+		void generateAll(u_int maxMen, const std::string& directory, u_int threadCount, const std::string& only = "") {
+			Tablebases generated;
+			std::filesystem::create_directories(directory);
+			for (const Signature& sig : computeSignatures(maxMen)) {
+				const std::string path = directory + "/" + sig.name + ".tb";
+				if (!std::filesystem::exists(path) && (only.empty() || only == sig.name)) {
+					auto begin = std::chrono::high_resolution_clock::now();
+					generate(sig, path, generated, threadCount);
+					auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+					std::cout << sig.name << " | positions " << 2 * sig.size << " | Time: " << ms << "ms" << std::endl;
+				}
+				if (std::filesystem::exists(path)) generated.add(sig.name, path);
+				if (!only.empty() && only == sig.name) return;
+			}
+		}
+
+		// every position of the table against the best of its moves looked up one ply deeper (double pushes with their
+		// en passant captures), tables it converts into must be open as well, returns the positions that disagree
+		uint64_t verify(const Signature& sig, const Tablebases& tables, u_int threadCount) {
+			const uint64_t entryCount = 2 * sig.size;
+			threadCount = std::max(threadCount, 1u);
+			std::atomic<uint64_t> mismatches(0);
+			std::atomic<bool> missing(false);
+			auto work = [&](u_int t) {
+				uint64_t threadMismatches = 0;
+				for (uint64_t e = entryCount * t / threadCount; e < entryCount * (t + 1) / threadCount && !missing; e++) {
+					bitboard::Bitboards bb;
+					bool activeColor;
+					if (!decodeEntry(sig, e, bb, activeColor)) continue;
+					MoveList moves;
+					pieceMovement::computeLegalMoves_Simple(bb, activeColor, -1, moves);
+					ProbeResult expected = { pieceMovement::isSquareAttacked(bb, activeColor, bitboard::getLsb(bb.getPieces(king, activeColor))) ? loss : draw, 0 };
+					for (size_t i = 0; i < moves.size(); i++) {
+						bitboard::Bitboards child;
+						computeChild(bb, activeColor, moves[i], child);
+						ProbeResult result = { draw, 0 };
+						if (!tables.probeDtm(child, !activeColor, computeEnPassantTarget(bb, activeColor, moves[i]), result)) missing = true;
+						result = computeParentResult(result);
+						if (!i || isBetter(result, expected)) expected = result;
+					}
+					ProbeResult stored = { draw, 0 };
+					if (!tables.probeDtm(bb, activeColor, stored)) missing = true;
+					threadMismatches += stored.wdl != expected.wdl || stored.dtm != expected.dtm;
+				}
+				mismatches += threadMismatches;
+			};
+			std::vector<std::thread> threads;
+			for (u_int t = 1; t < threadCount; t++) threads.emplace_back(work, t);
+			work(0);
+			for (auto& t : threads) t.join();
+			if (missing) throw "missing tablebase for a capture or promotion";
+			return mismatches;
+		}
+	}
+
+	namespace search {
+
+		const int16_t INFINITE_SCORE = 32001;
+		const int16_t MATE_SCORE = 32000;  // mated at the root, MATE_SCORE - ply when mated deeper
+		const int8_t MAX_PLY = 100;
+		const int16_t MATE_BOUND = MATE_SCORE - MAX_PLY - tablebase::MAX_DTM;  // scores past this are mates, tablebase ones found at any ply too
+
+		enum Bound : uint8_t { noBound, upperBound, lowerBound, exactBound };
+
+		struct TTEntry {
+			Move move;
+			int16_t score;
+			int8_t depth;
+			uint8_t generation;
+			Bound bound;
+		};
+
+		// mate scores are stored relative to the node, not the root
+		int16_t scoreToTT(int16_t score, int8_t ply) {
+			return score >= MATE_BOUND ? score + ply : (score <= -MATE_BOUND ? score - ply : score);
+		}
+
+		int16_t scoreFromTT(int16_t score, int8_t ply) {
+			return score >= MATE_BOUND ? score - ply : (score <= -MATE_BOUND ? score + ply : score);
+		}
+
+		class TranspositionTable {
+			// fixed size, buckets of 4 slots on one cache line, shared by all search threads without locks:
+			// a slot stores key ^ data next to data, a slot torn by two concurrent writers fails the key check
+			// an isolated table keeps its memory, but every search only sees its own entries, as if it started from a clear table
+			private:
+				struct Slot {
+					std::atomic<uint64_t> keyXorData;
+					std::atomic<uint64_t> data;  // move | score | depth | generation | bound, 0 = empty
+				};
+
+				struct alignas(64) Bucket {
+					Slot slots[4];
+				};
+
+				std::unique_ptr<Bucket[]> buckets;
+				size_t bucketCount = 0;
+				uint8_t generation = 0;
+				bool isolated = false;
+
+				static uint64_t pack(const TTEntry& e) {
+					return uint64_t(e.move) | (uint64_t(uint16_t(e.score)) << 16) | (uint64_t(uint8_t(e.depth)) << 32)
+						| (uint64_t(e.generation) << 40) | (uint64_t(e.bound) << 48);
+				}
+
+				static TTEntry unpack(uint64_t data) {
+					return { Move(data), int16_t(data >> 16), int8_t(data >> 32), uint8_t(data >> 40), Bound((data >> 48) & 3) };
+				}
+
+				Bucket& getBucket(uint64_t key) const {
+					return buckets[key & (bucketCount - 1)];
+				}
+
+				bool isStale(uint64_t data) const {  // left by an earlier search of an isolated table
+					return isolated && uint8_t(data >> 40) != generation;
+				}
+
+			public:
+				explicit TranspositionTable(size_t sizeMB, bool isolated = false) : isolated(isolated) {
+					resize(sizeMB);
+				}
+
+				void resize(size_t sizeMB) {  // rounded down to a power of two number of buckets, not thread safe
+					size_t count = 1;
+					while (count * 2 * sizeof(Bucket) <= sizeMB * 1024 * 1024) count *= 2;
+					buckets.reset(new Bucket[count]);
+					bucketCount = count;
+					clear();
+				}
+
+				void clear() {  // not thread safe
+					for (size_t i = 0; i < bucketCount; i++) {
+						for (Slot& slot : buckets[i].slots) {
+							slot.keyXorData.store(0, std::memory_order_relaxed);
+							slot.data.store(0, std::memory_order_relaxed);
+						}
+					}
+					generation = 0;
+				}
+
+				void newSearch() {
+					generation++;
+					if (isolated && generation == 0) clear();  // entries 256 searches old would look new again
+				}
+
+				void prefetch(uint64_t key) const {
+					__builtin_prefetch(&getBucket(key));
+				}
+
+				bool probe(uint64_t key, TTEntry& entry) const {
+					CHESS_STATS_TIME(ttProbes);
+					for (const Slot& slot : getBucket(key).slots) {
+						uint64_t data = slot.data.load(std::memory_order_relaxed);
+						if (data && (slot.keyXorData.load(std::memory_order_relaxed) ^ data) == key && !isStale(data)) {
+							entry = unpack(data);
+							CHESS_STATS_COUNT(ttHits);
+							return true;
+						}
+					}
+					return false;
+				}
+
+				void store(uint64_t key, Move move, int16_t score, int8_t depth, Bound bound) {
+					// same position or empty slot first, else the shallowest entry (older searches count as shallower)
+					Bucket& bucket = getBucket(key);
+					Slot* replace = nullptr;
+					int replaceValue = 0;
+					for (Slot& slot : bucket.slots) {
+						uint64_t data = slot.data.load(std::memory_order_relaxed);
+						if (!data || isStale(data)) {
+							replace = &slot;
+							break;
+						}
+						if ((slot.keyXorData.load(std::memory_order_relaxed) ^ data) == key) {
+							if (move == NULL_MOVE) move = unpack(data).move;
+							replace = &slot;
+							break;
+						}
+						TTEntry e = unpack(data);
+						int value = e.depth - 8 * uint8_t(generation - e.generation);
+						if (!replace || value < replaceValue) {
+							replace = &slot;
+							replaceValue = value;
+						}
+					}
+					uint64_t data = pack({ move, score, depth, generation, bound });
+					replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+					replace->data.store(data, std::memory_order_relaxed);
+				}
+
+				int hashfull() const {  // per mille of the first 1000 buckets used by this search
+					int used = 0;
+					size_t count = std::min<size_t>(1000, bucketCount);
+					for (size_t i = 0; i < count; i++) {
+						for (const Slot& slot : buckets[i].slots) {
+							uint64_t data = slot.data.load(std::memory_order_relaxed);
+							used += data && unpack(data).generation == generation;
+						}
+					}
+					return used * 250 / int(count);
+				}
+		};
+
+		struct SearchLimits {
+			int8_t depth = MAX_PLY - 1;
+			uint64_t nodes = 0;  // 0 = no limit
+			int64_t moveTime = 0;  // ms, 0 = no limit, the search stops there
+			int64_t softTime = 0;  // ms, 0 = no limit, no new depth is started once half of it is used
+			const std::atomic<bool>* ponder = nullptr;  // time limits wait while it is set, the clock starts when it is cleared
+		};
+
+		struct TimeControl {  // what is left on our clock
+			int64_t time = 0;  // ms
+			int64_t increment = 0;  // ms per move
+			int movesToGo = 0;  // until the next time control, 0 = the rest of the game
+		};
+
+		// a share of the remaining time for a move, up to 4 times more when the current depth takes long
+		void allocateTime(const TimeControl& tc, SearchLimits& limits) {
+			const int64_t OVERHEAD = 20;  // ms kept for the communication with the gui
+			const int64_t available = std::max<int64_t>(1, tc.time - OVERHEAD);
+			const int movesToGo = tc.movesToGo ? std::min(tc.movesToGo, 40) : 30;
+			limits.softTime = std::max<int64_t>(1, std::min(available, available / movesToGo + tc.increment * 3 / 4));
+			limits.moveTime = std::max(limits.softTime, std::min(limits.softTime * 4, available / 2));
+		}
+
+		struct SearchResult {
+			Move bestMove = NULL_MOVE;
+			int16_t score = 0;
+			std::vector<Move> pv;
+			int8_t depth = 0;
+			uint64_t nodes = 0;
+			int64_t time = 0;  // ms
+			uint64_t nps = 0;
+			std::vector<uint64_t> threadNodes;  // nodes searched by each thread, main thread first
+			uint64_t pawnProbes = 0;  // pawn table lookups of all threads
+			uint64_t pawnHits = 0;
+		};
+
+		std::string computeScoreToString(int16_t score) {  // uci style: cp 35, mate 3, mate -2
+			if (score >= MATE_BOUND) return "mate " + std::to_string((MATE_SCORE - score + 1) / 2);
+			if (score <= -MATE_BOUND) return "mate " + std::to_string(-(MATE_SCORE + score) / 2);
+			return "cp " + std::to_string(score);
+		}
+
+		class HistoryTable {
+			// how well quiet moves did, by color, from and to: cutoffs add, moves tried before a cutoff lose
+			// every update pulls the value towards its bound by a share of the distance, so recent results weigh more
+			private:
+				int16_t values[2][64][64] = {};
+
+			public:
+				static const int MAX_VALUE = 16384;
+
+				int16_t get(bool color, Move move) const {
+					return values[color][getMoveFrom(move)][getMoveTo(move)];
+				}
+
+				void update(bool color, Move move, int bonus) {  // bonus in -MAX_VALUE..MAX_VALUE
+					int16_t& value = values[color][getMoveFrom(move)][getMoveTo(move)];
+					value += bonus - value * std::abs(bonus) / MAX_VALUE;
+				}
+		};
+
+		class MovePicker {
+			// hands out the legal moves of a node one at a time, in stages: hash move, captures and queen promotions that do not
+			// lose material (most valuable victim, least valuable attacker), killers, quiet moves by history, captures that lose material
+			// a stage is generated only when the previous ones are used up, a cutoff on a capture never generates the quiet moves
+			private:
+				enum Stage { hashStage, captureGeneration, goodCaptureStage, killerStage, quietGeneration, quietStage, badCaptureStage, done };
+
+				const Position& pos;
+				const HistoryTable& history;
+				Stage stage;
+				Move hashMove;
+				Move killers[2];
+				bool withQuiets;  // else only the captures that do not lose material
+				MoveList moves;  // the captures and queen promotions, then the other moves
+				int scores[MoveList::MAX_MOVES];
+				size_t current = 0;
+				MoveList badCaptures;
+
+				int computeCaptureScore(Move move) const {
+					const int8_t to = getMoveTo(move);
+					int victim = pos.board[to] != empty ? evaluation::PIECE_VALUES[getPieceId(pos.board[to])]
+						: getMoveFlag(move) == enPassantMove ? evaluation::PIECE_VALUES[pawn] : 0;
+					if (getMoveFlag(move) == promotionMove) victim += evaluation::PIECE_VALUES[getMovePromotion(move)];
+					return 1000 * victim - evaluation::PIECE_VALUES[getPieceId(pos.board[getMoveFrom(move)])];
+				}
+
+				int computeQuietScore(Move move) const {  // underpromotions last
+					if (getMoveFlag(move) == promotionMove) return -2 * HistoryTable::MAX_VALUE;
+					return history.get(pos.activeColor, move);
+				}
+
+				bool isGoodCapture(Move move) const {  // no exchange to look at when the victim is worth at least the attacker
+					const int8_t to = getMoveTo(move);
+					const int16_t victim = pos.board[to] != empty ? evaluation::PIECE_VALUES[getPieceId(pos.board[to])]
+						: getMoveFlag(move) == enPassantMove ? evaluation::PIECE_VALUES[pawn] : 0;
+					return victim >= evaluation::PIECE_VALUES[getPieceId(pos.board[getMoveFrom(move)])] || evaluation::computeSee(pos, move) >= 0;
+				}
+
+				static bool isQueenPromotion(Move move) {
+					return getMoveFlag(move) == promotionMove && getMovePromotion(move) == queen;
+				}
+
+				// the queen promotions that capture nothing, they win as much as a capture and quiescence has to see them
+				void addQueenPushes() {
+					const bool color = pos.activeColor;
+					bitboard::Bitboard pawns = pos.bitboards.getPieces(pawn, color) & (color ? bitboard::ROW_8 << 8 : bitboard::ROW_1 >> 8);
+					while (pawns) {
+						const int8_t from = bitboard::popLsb(pawns);
+						const int8_t to = color ? from - 8 : from + 8;
+						const Move move = createMove(from, to, promotionMove, queen);
+						if (pos.board[to] == empty && pos.isLegalMove(move)) moves.push_back(move);
+					}
+				}
+
+				Move pickBest() {  // one selection sort step, most nodes are cut off long before the list would be sorted
+					size_t best = current;
+					for (size_t i = current + 1; i < moves.size(); i++) {
+						if (scores[i] > scores[best]) best = i;
+					}
+					std::swap(moves[current], moves[best]);
+					std::swap(scores[current], scores[best]);
+					return moves[current++];
+				}
+
+			public:
+				MovePicker(const Position& pos, Move hashMove, const Move killers[2], const HistoryTable& history) :
+				pos(pos), history(history), stage(hashStage), hashMove(hashMove), killers{ killers[0], killers[1] }, withQuiets(true) {
+
+				}
+
+				// quiescence: only the captures that do not lose material, every move when in check
+				MovePicker(const Position& pos, const HistoryTable& history) :
+				pos(pos), history(history), stage(captureGeneration), hashMove(NULL_MOVE), killers{ NULL_MOVE, NULL_MOVE }, withQuiets(pos.isInCheck()) {
+
+				}
+
+				Move next() {  // NULL_MOVE once every move was handed out
+					while (true) {
+						switch (stage) {
+							case hashStage:
+								stage = captureGeneration;
+								if (hashMove != NULL_MOVE && pos.isLegalMove(hashMove)) return hashMove;
+								break;
+							case captureGeneration:
+								pos.computeLegalMoves<pieceMovement::captureMoves>(moves);
+								addQueenPushes();
+								for (size_t i = 0; i < moves.size(); i++) scores[i] = computeCaptureScore(moves[i]);
+								stage = goodCaptureStage;
+								break;
+							case goodCaptureStage:
+								while (current < moves.size()) {
+									Move move = pickBest();
+									if (move == hashMove) continue;
+									if (isGoodCapture(move)) return move;
+									if (withQuiets) badCaptures.push_back(move);
+								}
+								stage = withQuiets ? killerStage : done;
+								current = 0;
+								break;
+							case killerStage:
+								while (current < 2) {
+									Move move = killers[current++];
+									if (move != NULL_MOVE && move != hashMove && pos.board[getMoveTo(move)] == empty && pos.isLegalMove(move)) return move;
+								}
+								stage = quietGeneration;
+								break;
+							case quietGeneration:
+								moves.clear();
+								pos.computeLegalMoves<pieceMovement::quietMoves>(moves);
+								for (size_t i = 0; i < moves.size(); i++) scores[i] = computeQuietScore(moves[i]);
+								current = 0;
+								stage = quietStage;
+								break;
+							case quietStage:
+								while (current < moves.size()) {
+									Move move = pickBest();
+									if (move != hashMove && move != killers[0] && move != killers[1] && !isQueenPromotion(move)) return move;
+								}
+								current = 0;
+								stage = badCaptureStage;
+								break;
+							case badCaptureStage:
+								if (current < badCaptures.size()) return badCaptures[current++];
+								stage = done;
+								break;
+							case done:
+								return NULL_MOVE;
+						}
+					}
+				}
+		};
+
+		class Searcher {
+			// iterative deepening, principal variation search and quiescence on captures
+			// one per search thread, threads only share the transposition table, the stop signal and the node count
+			private:
+				Position pos;
+				TranspositionTable& tt;
+				std::atomic<bool>& stopSignal;
+				std::atomic<uint64_t>& totalNodes;  // all threads, updated every 1024 nodes
+				SearchLimits limits;
+				u_int threadId;  // 0 = main thread
+				std::chrono::high_resolution_clock::time_point start;
+				uint64_t nodes = 0;
+				bool stopped = false;
+				bool pondering = false;
+				std::vector<uint64_t> keyHistory;  // positions before the current one, game then search path
+				Move pv[MAX_PLY + 1][MAX_PLY + 1];
+				int8_t pvLength[MAX_PLY + 1];
+				Move killers[MAX_PLY + 1][2] = {};  // last two quiet moves that caused a cutoff, by ply
+				HistoryTable history;
+
+				int64_t computeElapsed() const {
+					return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+				}
+
+				bool isPondering() {  // the clock starts again when pondering ends
+					if (!pondering) return false;
+					pondering = limits.ponder->load(std::memory_order_relaxed);
+					if (!pondering) start = std::chrono::high_resolution_clock::now();
+					return pondering;
+				}
+
+				void checkLimits() {  // the stop signal is read at every node, so a stop is answered at once
+					if (stopSignal.load(std::memory_order_relaxed)) stopped = true;
+					if (stopped || (nodes & 1023)) return;
+					uint64_t total = totalNodes.fetch_add(1024, std::memory_order_relaxed) + 1024;
+					if ((limits.nodes && total >= limits.nodes) || (limits.moveTime && !isPondering() && computeElapsed() >= limits.moveTime)) stopped = true;
+				}
+
+				bool isDraw() const {  // fifty moves or repetition since the last irreversible move
+					if (pos.halfmoveClock >= 100) return true;
+					int last = std::max<int>(0, int(keyHistory.size()) - pos.halfmoveClock);
+					for (int i = int(keyHistory.size()) - 2; i >= last; i -= 2) {
+						if (keyHistory[i] == pos.key) return true;
+					}
+					return false;
+				}
+
+				bool isCapture(Move move) const {
+					return pos.board[getMoveTo(move)] != empty || getMoveFlag(move) == enPassantMove;
+				}
+
+				// a quiet move caused a cutoff: it becomes the first killer of the ply, the quiet moves tried before it lose history
+				void updateQuietStats(Move move, int8_t ply, int8_t depth, const Move* tried, size_t triedCount) {
+					if (killers[ply][0] != move) {
+						killers[ply][1] = killers[ply][0];
+						killers[ply][0] = move;
+					}
+					const int bonus = std::min(32 * depth * depth, HistoryTable::MAX_VALUE / 8);
+					history.update(pos.activeColor, move, bonus);
+					for (size_t i = 0; i < triedCount; i++) history.update(pos.activeColor, tried[i], -bonus);
+				}
+
+				int16_t quiescence(int16_t alpha, int16_t beta, int8_t ply) {
+					pvLength[ply] = ply;
+					nodes++;
+					checkLimits();
+					if (stopped) return 0;
+					if (ply >= MAX_PLY) return evaluation::evaluate(pos);
+
+					// in check every evasion is searched, there is no standing pat
+					const bool inCheck = pos.isInCheck();
+					int16_t bestScore = -INFINITE_SCORE;
+					if (!inCheck) {
+						bestScore = evaluation::evaluate(pos);
+						if (bestScore >= beta) return bestScore;
+						if (bestScore > alpha) alpha = bestScore;
+					}
+					MovePicker picker(pos, history);  // captures that lose material are not searched
+					size_t moveCount = 0;
+					while (Move move = picker.next()) {
+						moveCount++;
+						UndoInfo undo = pos.makeMove(move);
+						int16_t score = -quiescence(-beta, -alpha, ply + 1);
+						pos.unmakeMove(move, undo);
+						if (stopped) return 0;
+						if (score > bestScore) {
+							bestScore = score;
+							if (score > alpha) {
+								alpha = score;
+								if (alpha >= beta) break;
+							}
+						}
+					}
+					if (inCheck && moveCount == 0) return -MATE_SCORE + ply;
+					return bestScore;
+				}
+
+				int16_t negamax(int16_t alpha, int16_t beta, int8_t depth, int8_t ply) {
+					tablebase::ProbeResult tbResult;
+					if (ply > 0 && tablebase::tablebases.probe(pos, tbResult)) {  // exact mate distance, from the side to move
+						nodes++;
+						pvLength[ply] = ply;
+						if (tbResult.wdl == tablebase::draw) return 0;
+						return tbResult.wdl == tablebase::win ? MATE_SCORE - ply - tbResult.dtm : -MATE_SCORE + ply + tbResult.dtm;
+					}
+					const bool inCheck = pos.isInCheck();
+					if (inCheck) depth++;
+					if (depth <= 0) return quiescence(alpha, beta, ply);
+					pvLength[ply] = ply;
+					nodes++;
+					checkLimits();
+					if (stopped) return 0;
+					if (ply > 0 && isDraw()) return 0;
+					if (ply >= MAX_PLY) return evaluation::evaluate(pos);
+
+					const bool pvNode = beta - alpha > 1;
+					Move hashMove = NULL_MOVE;
+					TTEntry entry;
+					if (tt.probe(pos.key, entry)) {
+						hashMove = entry.move;
+						int16_t score = scoreFromTT(entry.score, ply);
+						if (!pvNode && entry.depth >= depth && (entry.bound == exactBound
+							|| (entry.bound == lowerBound && score >= beta) || (entry.bound == upperBound && score <= alpha))) return score;
+					}
+
+					const int16_t originalAlpha = alpha;
+					int16_t bestScore = -INFINITE_SCORE;
+					Move bestMove = NULL_MOVE;
+					MovePicker picker(pos, hashMove, killers[ply], history);
+					size_t moveCount = 0;
+					Move quietsTried[64];
+					size_t quietCount = 0;
+					while (Move move = picker.next()) {
+						const bool quiet = !isCapture(move) && getMoveFlag(move) != promotionMove;
+						const size_t i = moveCount++;
+						UndoInfo undo = pos.makeMove(move);
+						tt.prefetch(pos.key);
+						keyHistory.push_back(undo.key);
+						int16_t score;
+						if (i == 0) {
+							score = -negamax(-beta, -alpha, depth - 1, ply + 1);
+						} else {  // null window first, full window again only if it beats alpha
+							score = -negamax(-alpha - 1, -alpha, depth - 1, ply + 1);
+							if (score > alpha && score < beta) score = -negamax(-beta, -alpha, depth - 1, ply + 1);
+						}
+						keyHistory.pop_back();
+						pos.unmakeMove(move, undo);
+						if (stopped) return 0;
+
+						if (score > bestScore) {
+							bestScore = score;
+							bestMove = move;
+							if (score > alpha) {
+								alpha = score;
+								pv[ply][ply] = move;
+								for (int8_t j = ply + 1; j < pvLength[ply + 1]; j++) pv[ply][j] = pv[ply + 1][j];
+								pvLength[ply] = std::max<int8_t>(pvLength[ply + 1], ply + 1);
+								if (alpha >= beta) {
+									if (quiet) updateQuietStats(move, ply, depth, quietsTried, quietCount);
+									break;
+								}
+							}
+						}
+						if (quiet && quietCount < 64) quietsTried[quietCount++] = move;
+					}
+					if (moveCount == 0) return inCheck ? -MATE_SCORE + ply : 0;
+					Bound bound = bestScore >= beta ? lowerBound : (bestScore > originalAlpha ? exactBound : upperBound);
+					tt.store(pos.key, bestMove, scoreToTT(bestScore, ply), depth, bound);
+					return bestScore;
+				}
+
+			public:
+				Searcher(const Position& pos, TranspositionTable& tt, std::atomic<bool>& stopSignal, std::atomic<uint64_t>& totalNodes,
+					const SearchLimits& limits, u_int threadId) :
+				pos(pos), tt(tt), stopSignal(stopSignal), totalNodes(totalNodes), limits(limits), threadId(threadId),
+				pondering(limits.ponder && limits.ponder->load()), keyHistory(pos.computeKeyHistory()) {
+
+				}
+
+				uint64_t getNodes() const {
+					return nodes;
+				}
+
+				// onIteration is called after every completed depth, reported nodes are for all threads
+				// helper threads start one ply deeper every other thread so they do not all search the same tree
+				SearchResult run(const std::function<void(const SearchResult&)>& onIteration) {
+					start = std::chrono::high_resolution_clock::now();
+					SearchResult result;
+					MoveList rootMoves;
+					pos.computeLegalMoves(rootMoves);
+					if (rootMoves.size() == 0) return result;
+					result.bestMove = rootMoves[0];
+
+					for (int8_t depth = 1 + threadId % 2; depth <= limits.depth && depth < MAX_PLY; depth++) {
+						int16_t score = negamax(-INFINITE_SCORE, INFINITE_SCORE, depth, 0);
+						if (stopped) break;
+						result.depth = depth;
+						result.score = score;
+						result.pv.assign(pv[0], pv[0] + pvLength[0]);
+						if (!result.pv.empty()) result.bestMove = result.pv[0];
+						result.nodes = totalNodes.load(std::memory_order_relaxed) + (nodes & 1023);
+						result.time = computeElapsed();
+						result.nps = result.nodes * 1000 / (result.time + 1);
+						if (onIteration) onIteration(result);
+						// the next depth usually takes longer than all the previous ones together
+						if (threadId == 0 && limits.softTime && !isPondering() && 2 * computeElapsed() >= limits.softTime) break;
+					}
+					totalNodes.fetch_add(nodes & 1023, std::memory_order_relaxed);
+					result.time = computeElapsed();
+					return result;
+				}
+		};
+
+		// lazy smp: every thread searches the same root, they help each other through the shared transposition table
+		// stopSignal can be raised from outside to end the search early, it is raised when the search ends
+		SearchResult search(const Position& pos, const SearchLimits& limits, TranspositionTable& tt, u_int threadCount,
+			std::atomic<bool>& stopSignal, const std::function<void(const SearchResult&)>& onIteration) {
+			if (threadCount < 1) threadCount = 1;
+			tt.newSearch();
+			std::atomic<uint64_t> totalNodes(0);
+			std::vector<SearchResult> results(threadCount);
+			std::vector<uint64_t> threadNodes(threadCount);
+			std::vector<std::pair<uint64_t, uint64_t>> pawnCounts(threadCount);  // probes and hits
+			auto worker = [&](u_int id) {
+				const evaluation::PawnTable& pawnTable = evaluation::getPawnTable();
+				const uint64_t hits = pawnTable.getHits(), probes = hits + pawnTable.getMisses();
+				Searcher searcher(pos, tt, stopSignal, totalNodes, limits, id);
+				results[id] = searcher.run(id == 0 ? onIteration : nullptr);
+				threadNodes[id] = searcher.getNodes();
+				pawnCounts[id] = { pawnTable.getHits() + pawnTable.getMisses() - probes, pawnTable.getHits() - hits };
+			};
+			std::vector<std::thread> helpers;
+			for (u_int id = 1; id < threadCount; id++) helpers.emplace_back(worker, id);
+			worker(0);
+			stopSignal = true;
+			for (std::thread& t : helpers) t.join();
+
+			// a helper that finished a deeper iteration than the main thread has the better move
+			SearchResult result = results[0];
+			for (const SearchResult& r : results) {
+				if (r.depth > result.depth && !r.pv.empty()) result = r;
+			}
+			result.nodes = totalNodes;
+			result.time = results[0].time;
+			result.nps = result.nodes * 1000 / (result.time + 1);
+			result.threadNodes = threadNodes;
+			for (const auto& counts : pawnCounts) {
+				result.pawnProbes += counts.first;
+				result.pawnHits += counts.second;
+			}
+			return result;
+		}
+
+		SearchResult search(const Position& pos, const SearchLimits& limits, TranspositionTable& tt, u_int threadCount,
+			const std::function<void(const SearchResult&)>& onIteration) {
+			std::atomic<bool> stopSignal(false);
+			return search(pos, limits, tt, threadCount, stopSignal, onIteration);
+		}
+
+		const std::string SMP_BENCH_FENS[] = {
+			START_FEN,
+			"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+			"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+			"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		};
+
+		// time to depth on a few positions with 1, 2, 4, ... threads, speedup is relative to one thread
+		void runSmpBenchmark(int8_t depth, size_t hashMB, u_int maxThreads) {
+			TranspositionTable tt(hashMB);
+			SearchLimits limits;
+			limits.depth = depth;
+			int64_t baseTime = 0;
+			for (u_int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+				int64_t time = 0;
+				uint64_t nodes = 0;
+				for (const std::string& fen : SMP_BENCH_FENS) {
+					tt.clear();
+					SearchResult result = search(convert::computePositionFromFen(fen), limits, tt, threadCount, nullptr);
+					time += result.time;
+					nodes += result.nodes;
+				}
+				if (threadCount == 1) baseTime = time;
+				std::cout << "threads " << threadCount << " | time " << time << "ms | nodes " << nodes << " | nps " << nodes * 1000 / (time + 1)
+					<< " | speedup " << double(baseTime) / (time + 1e-9) << "x" << std::endl;
+			}
+		}
+
+		std::string computeInfoString(const SearchResult& result) {  // uci info line
+			std::string s = "info depth " + std::to_string(result.depth) + " score " + computeScoreToString(result.score) + " nodes " + std::to_string(result.nodes)
+				+ " nps " + std::to_string(result.nps) + " time " + std::to_string(result.time) + " pv";
+			for (Move move : result.pv) s += " " + convert::computeMoveToString(move);
+			return s;
+		}
+
+		void printInfo(const SearchResult& result) {
+			std::cout << computeInfoString(result) << std::endl;
+		}
+	}
+
+	namespace uci {
+
+		// the legal move written as e2e4 / e7e8q, throws when there is none
+		Move computeMoveFromString(Position& pos, const std::string& s) {
+			MoveList moves;
+			pos.computeLegalMoves(moves);
+			for (Move move : moves) {
+				if (convert::computeMoveToString(move) == s) return move;
+			}
+			throw "illegal move";
+		}
+
+		// commands are read on the calling thread and searches run on their own thread,
+		// so stop, ponderhit and isready are answered while searching
+		class Engine {
+			private:
+				std::ostream& out;
+				std::mutex outMutex;
+				Position pos = convert::computePositionFromFen(START_FEN);
+				search::TranspositionTable tt{16};
+				u_int threadCount = 1;
+				std::thread searchThread;
+				std::atomic<bool> stopSignal{false};
+				std::atomic<bool> pondering{false};
+				// go infinite and go ponder must not send bestmove before stop or ponderhit
+				std::mutex holdMutex;
+				std::condition_variable holdCondition;
+				bool holding = false;
+
+				void send(const std::string& line) {
+					std::lock_guard<std::mutex> lock(outMutex);
+					out << line << std::endl;
+				}
+
+				void release() {
+					{
+						std::lock_guard<std::mutex> lock(holdMutex);
+						holding = false;
+					}
+					holdCondition.notify_all();
+				}
+
+				void stopSearch() {  // returns once bestmove is sent
+					stopSignal = true;
+					pondering = false;
+					release();
+					if (searchThread.joinable()) searchThread.join();
+				}
+
+				void setPosition(std::istringstream& words) {
+					std::string word, fen;
+					words >> word;
+					if (word == "startpos") {
+						fen = START_FEN;
+						words >> word;
+					} else if (word == "fen") {
+						while (words >> word && word != "moves") fen += (fen.empty() ? "" : " ") + word;
+					} else {
+						throw "expected startpos or fen";
+					}
+					Position newPos = convert::computePositionFromFen(fen);
+					if (word == "moves") {
+						while (words >> word) newPos.pushMove(computeMoveFromString(newPos, word));
+					}
+					pos = newPos;
+				}
+
+				void go(std::istringstream& words) {
+					search::SearchLimits limits;
+					search::TimeControl tc[2];  // black, white
+					bool infinite = false, ponder = false;
+					std::string word;
+					while (words >> word) {
+						if (word == "infinite") infinite = true;
+						else if (word == "ponder") ponder = true;
+						else if (word == "depth") { int depth; words >> depth; limits.depth = std::clamp(depth, 1, search::MAX_PLY - 1); }
+						else if (word == "nodes") words >> limits.nodes;
+						else if (word == "movetime") words >> limits.moveTime;
+						else if (word == "wtime") words >> tc[1].time;
+						else if (word == "btime") words >> tc[0].time;
+						else if (word == "winc") words >> tc[1].increment;
+						else if (word == "binc") words >> tc[0].increment;
+						else if (word == "movestogo") { words >> tc[0].movesToGo; tc[1].movesToGo = tc[0].movesToGo; }
+					}
+					if (tc[pos.activeColor].time && !infinite) search::allocateTime(tc[pos.activeColor], limits);
+					if (infinite) limits.moveTime = limits.softTime = 0;
+					pondering = ponder;
+					limits.ponder = &pondering;
+					stopSignal = false;
+					holding = infinite || ponder;
+					searchThread = std::thread([this, limits]() {
+						search::SearchResult result = search::search(pos, limits, tt, threadCount, stopSignal,
+							[this](const search::SearchResult& r) { send(search::computeInfoString(r)); });
+						{
+							std::unique_lock<std::mutex> lock(holdMutex);
+							holdCondition.wait(lock, [this]() { return !holding; });
+						}
+						std::string line = "bestmove " + (result.bestMove ? convert::computeMoveToString(result.bestMove) : std::string("0000"));
+						if (result.pv.size() > 1) line += " ponder " + convert::computeMoveToString(result.pv[1]);
+						send(line);
+					});
+				}
+
+				void setOption(std::istringstream& words) {
+					std::string word, name, value;
+					words >> word;  // name
+					while (words >> word && word != "value") name += (name.empty() ? "" : " ") + word;
+					std::getline(words >> std::ws, value);
+					if (name == "Hash") tt.resize(std::max(1, std::stoi(value)));
+					else if (name == "PawnHash") evaluation::pawnTableSizeMB = std::max(0, std::stoi(value));
+					else if (name == "Threads") threadCount = std::max(1, std::stoi(value));
+					else if (name == "TablebasePath") send("info string tables " + std::to_string(tablebase::tablebases.open(value)));
+					else if (name == "EvalFile") {
+						if (value.empty()) nnue::unload();
+						else nnue::load(value);
+					}
+					else throw "unknown option";
+				}
+
+			public:
+				explicit Engine(std::ostream& out) : out(out) {
+
+				}
+
+				~Engine() {
+					stopSearch();
+				}
+
+				// false after quit
+				bool runCommand(const std::string& line) {
+					std::istringstream words(line);
+					std::string command;
+					words >> command;
+					try {
+						if (command == "uci") {
+							send("id name ChessEngine");
+							send("id author 1Intuition");
+							send("option name Hash type spin default 16 min 1 max 65536");
+							send("option name PawnHash type spin default 1 min 0 max 1024");
+							send("option name Threads type spin default 1 min 1 max 1024");
+							send("option name Ponder type check default false");
+							send("option name TablebasePath type string default <empty>");
+							send("option name EvalFile type string default <empty>");
+							send("uciok");
+						} else if (command == "isready") {
+							send("readyok");
+						} else if (command == "stop") {
+							stopSearch();
+						} else if (command == "ponderhit") {
+							pondering = false;
+							release();
+						} else if (command == "quit") {
+							stopSearch();
+							return false;
+						} else if (command == "ucinewgame") {
+							stopSearch();
+							tt.clear();
+						} else if (command == "position") {
+							stopSearch();
+							setPosition(words);
+						} else if (command == "go") {
+							stopSearch();
+							go(words);
+						} else if (command == "setoption") {
+							stopSearch();
+							setOption(words);
+						}
+					} catch (const char* s) {
+						send(std::string("info string error: ") + s);
+					} catch (const std::exception& e) {
+						send(std::string("info string error: ") + e.what());
+					}
+					return true;
+				}
+		};
+
+		int loop(std::istream& in, std::ostream& out) {
+			Engine engine(out);
+			std::string line;
+			while (std::getline(in, line)) {
+				if (!engine.runCommand(line)) break;
+			}
+			return 0;
+		}
+	}
+
+	namespace batch {
+		// json lines in, json lines out, one object per line:
+		//   {"id": 1, "fen": "<fen>", "op": "moves"}                  -> {"id": 1, "moves": ["e2e4", ...]}
+		//   {"id": 2, "fen": "<fen>", "op": "perft", "depth": 5}      -> {"id": 2, "nodes": 4865609}
+		//   {"id": 3, "fen": "<fen>", "op": "search", "depth": 10}    -> {"id": 3, "bestmove": "e2e4", "cp": 31, "depth": 10, "nodes": ..., "pv": [...]}
+		//   search takes "depth", "nodes" or both, a failed request gives {"id": ..., "error": "..."}
+		//   a search does not depend on the requests before it, whichever worker runs it
+		// results come back as soon as they are done, not in request order, the id (any json value, null without one) tells them apart
+
+		const int8_t MAX_PERFT_DEPTH = 15;
+
+		std::string computeJsonString(std::string_view s) {
+			std::string res = "\"";
+			for (char c : s) {
+				if (c == '"' || c == '\\') res += std::string("\\") + c;
+				else if (u_char(c) < 0x20) res += std::string("\\u00") + "0123456789abcdef"[c >> 4] + "0123456789abcdef"[c & 15];
+				else res += c;
+			}
+			return res + "\"";
+		}
+
+		// the values of a flat json object as written (strings with their quotes), nested objects and arrays are refused
+		std::vector<std::pair<std::string, std::string_view>> parseObject(std::string_view text) {
+			std::vector<std::pair<std::string, std::string_view>> fields;
+			size_t i = 0;
+			auto skipSpaces = [&]() {
+				while (i < text.size() && std::isspace(u_char(text[i]))) i++;
+			};
+			auto expect = [&](char c) {
+				skipSpaces();
+				if (i >= text.size() || text[i] != c) throw "malformed json";
+				i++;
+			};
+			auto readValue = [&]() {  // raw
+				skipSpaces();
+				const size_t begin = i;
+				if (i < text.size() && text[i] == '"') {
+					for (i++; i < text.size() && text[i] != '"'; i++) {
+						if (text[i] == '\\') i++;
+					}
+					if (i >= text.size()) throw "malformed json";
+					i++;
+				} else {
+					while (i < text.size() && text[i] != ',' && text[i] != '}' && !std::isspace(u_char(text[i]))) {
+						if (text[i] == '{' || text[i] == '[') throw "nested json values are not supported";
+						i++;
+					}
+					if (i == begin) throw "malformed json";
+				}
+				return text.substr(begin, i - begin);
+			};
+			expect('{');
+			skipSpaces();
+			if (i < text.size() && text[i] == '}') i++;
+			else {
+				while (true) {
+					std::string_view key = readValue();
+					if (key.size() < 2 || key[0] != '"') throw "malformed json";
+					expect(':');
+					fields.emplace_back(std::string(key.substr(1, key.size() - 2)), readValue());
+					skipSpaces();
+					if (i < text.size() && text[i] == ',') { i++; continue; }
+					expect('}');
+					break;
+				}
+			}
+			skipSpaces();
+			if (i != text.size()) throw "malformed json";
+			return fields;
+		}
+
+		std::string computeStringFromJson(std::string_view raw) {  // escapes are decoded, \u only for ascii
+			if (raw.size() < 2 || raw[0] != '"') throw "json value is not a string";
+			std::string res;
+			for (size_t i = 1; i + 1 < raw.size(); i++) {
+				if (raw[i] != '\\') {
+					res += raw[i];
+					continue;
+				}
+				switch (raw[++i]) {
+					case 'n': res += '\n'; break;
+					case 't': res += '\t'; break;
+					case 'r': res += '\r'; break;
+					case 'b': res += '\b'; break;
+					case 'f': res += '\f'; break;
+					case 'u': {
+						unsigned code = 0;
+						if (i + 4 >= raw.size() || std::from_chars(raw.data() + i + 1, raw.data() + i + 5, code, 16).ptr != raw.data() + i + 5 || code > 0x7F) {
+							throw "json escape not supported";
+						}
+						res += char(code);
+						i += 4;
+						break;
+					}
+					default: res += raw[i]; break;  // " \ /
+				}
+			}
+			return res;
+		}
+
+		uint64_t computeNumberFromJson(std::string_view raw, uint64_t max) {
+			uint64_t value = 0;
+			auto [end, error] = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+			if (error != std::errc() || end != raw.data() + raw.size() || value > max) throw "json number not valid";
+			return value;
+		}
+
+		class Client {
+			// where the results of one input go, written in blocks: when enough piled up, or when none of its requests is left
+			// in the pool, so a client waits on its own requests only
+			// a socket is closed with its last reference, after the last result of its requests
+			private:
+				std::mutex mutex;
+				std::string buffer;
+				std::ostream* out = nullptr;
+				int fd = -1;
+				size_t inFlight = 0;  // submitted, result not sent yet
+
+				void flushLocked() {
+					if (buffer.empty()) return;
+					if (out) out->write(buffer.data(), buffer.size()).flush();
+#ifndef _WIN32
+					// a client that went away loses its results, the server goes on
+					for (size_t written = 0; fd >= 0 && written < buffer.size();) {
+						ssize_t n = ::send(fd, buffer.data() + written, buffer.size() - written, MSG_NOSIGNAL);
+						if (n <= 0) break;
+						written += n;
+					}
+#endif
+					buffer.clear();
+				}
+
+			public:
+				explicit Client(std::ostream& out) : out(&out) {
+
+				}
+
+				explicit Client(int fd) : fd(fd) {
+
+				}
+
+				~Client() {
+					flush();
+#ifndef _WIN32
+					if (fd >= 0) close(fd);
+#endif
+				}
+
+				void expectResult() {  // before its request is submitted
+					std::lock_guard<std::mutex> lock(mutex);
+					inFlight++;
+				}
+
+				void send(const std::string& line) {  // the result of one request
+					std::lock_guard<std::mutex> lock(mutex);
+					buffer += line;
+					buffer += '\n';
+					if (--inFlight == 0 || buffer.size() >= 1 << 16) flushLocked();
+				}
+
+				void flush() {
+					std::lock_guard<std::mutex> lock(mutex);
+					flushLocked();
+				}
+		};
+
+		struct Request {
+			std::string line;
+			std::shared_ptr<Client> client;
+		};
+
+		// what a worker keeps from one request to the next, the pawn table of its thread stays warm as well
+		// the transposition table is isolated: its memory is reused, its entries are not, so an answer does not depend on the requests before
+		struct WorkerState {
+			search::TranspositionTable tt;
+			MoveList moves;
+			convert::FenFields fields;
+
+			explicit WorkerState(size_t hashMB) : tt(hashMB, true) {
+
+			}
+		};
+
+		// the fields of the result after the id, throws on a bad request
+		std::string computeResult(const std::vector<std::pair<std::string, std::string_view>>& fields, WorkerState& state) {
+			std::string_view fen, op, depth, nodes;
+			for (const auto& field : fields) {
+				if (field.first == "fen") fen = field.second;
+				else if (field.first == "op") op = field.second;
+				else if (field.first == "depth") depth = field.second;
+				else if (field.first == "nodes") nodes = field.second;
+			}
+			if (fen.empty()) throw "missing fen";
+			if (op.empty()) throw "missing op";
+			const std::string fenText = computeStringFromJson(fen);  // the fields keep views into it
+			convert::parseFen(fenText, state.fields);
+			Position pos = state.fields.toPosition();
+			convert::checkPosition(pos);
+			const std::string operation = computeStringFromJson(op);
+			if (operation == "moves") {
+				state.moves.clear();
+				pos.computeLegalMoves(state.moves);
+				std::string res = "\"moves\": [";
+				for (size_t i = 0; i < state.moves.size(); i++) res += (i ? ", \"" : "\"") + convert::computeMoveToString(state.moves[i]) + "\"";
+				return res + "]";
+			}
+			if (operation == "perft") {
+				if (depth.empty()) throw "perft needs a depth";
+				return "\"nodes\": " + std::to_string(perft::perft(pos, int8_t(computeNumberFromJson(depth, MAX_PERFT_DEPTH))));
+			}
+			if (operation == "search") {
+				if (depth.empty() && nodes.empty()) throw "search needs a depth or a node limit";
+				search::SearchLimits limits;
+				if (!depth.empty()) limits.depth = int8_t(std::max<uint64_t>(1, computeNumberFromJson(depth, search::MAX_PLY - 1)));
+				if (!nodes.empty()) limits.nodes = computeNumberFromJson(nodes, UINT64_MAX);
+				search::SearchResult result = search::search(pos, limits, state.tt, 1, nullptr);
+				if (!result.bestMove) return "\"bestmove\": null, " + std::string(pos.isInCheck() ? "\"mate\": 0" : "\"cp\": 0");
+				std::string score = search::computeScoreToString(result.score);  // cp 35, mate -2
+				std::string res = "\"bestmove\": \"" + convert::computeMoveToString(result.bestMove) + "\", \"" + score.substr(0, score.find(' ')) + "\": "
+					+ score.substr(score.find(' ') + 1) + ", \"depth\": " + std::to_string(result.depth) + ", \"nodes\": " + std::to_string(result.nodes) + ", \"pv\": [";
+				for (size_t i = 0; i < result.pv.size(); i++) res += (i ? ", \"" : "\"") + convert::computeMoveToString(result.pv[i]) + "\"";
+				return res + "]";
+			}
+			throw "unknown op";
+		}
+
+		std::string computeResponse(const std::string& line, WorkerState& state) {
+			std::string id = "null";
+			try {
+				std::vector<std::pair<std::string, std::string_view>> fields = parseObject(line);
+				for (const auto& field : fields) {
+					if (field.first == "id") id = std::string(field.second);
+				}
+				return "{\"id\": " + id + ", " + computeResult(fields, state) + "}";
+			} catch (const char* error) {
+				return "{\"id\": " + id + ", \"error\": " + computeJsonString(error) + "}";
+			} catch (const std::exception& e) {
+				return "{\"id\": " + id + ", \"error\": " + computeJsonString(e.what()) + "}";
+			}
+		}
+
+		class WorkerPool {
+			// one deque per worker: requests are dealt round robin to the back of the deques, a worker takes the front of its own
+			// and steals from the back of the others once it runs dry, so a few long searches do not hold up the queue behind them
+			// readers wait when too many requests are queued, so a huge input does not end up in memory
+			private:
+				struct Queue {
+					std::mutex mutex;
+					std::deque<Request> requests;
+				};
+
+				std::vector<std::unique_ptr<Queue>> queues;
+				std::vector<std::thread> workers;
+				std::mutex waitMutex;
+				std::condition_variable workAvailable;
+				std::condition_variable spaceAvailable;
+				size_t pending = 0;  // queued, not taken yet
+				size_t maxPending;
+				size_t next = 0;
+				bool closing = false;
+
+				bool tryTake(size_t self, Request& request) {
+					for (size_t i = 0; i < queues.size(); i++) {
+						Queue& queue = *queues[(self + i) % queues.size()];
+						std::lock_guard<std::mutex> lock(queue.mutex);
+						if (queue.requests.empty()) continue;
+						if (i == 0) {
+							request = std::move(queue.requests.front());
+							queue.requests.pop_front();
+						} else {
+							request = std::move(queue.requests.back());
+							queue.requests.pop_back();
+						}
+						return true;
+					}
+					return false;
+				}
+
+				void work(size_t self, size_t hashMB) {
+					WorkerState state(hashMB);
+					Request request;
+					while (true) {
+						if (!tryTake(self, request)) {
+							std::unique_lock<std::mutex> lock(waitMutex);
+							workAvailable.wait(lock, [this]() { return pending > 0 || closing; });
+							if (pending == 0 && closing) return;
+							continue;  // a request counted but not pushed yet
+						}
+						{
+							std::lock_guard<std::mutex> lock(waitMutex);
+							pending--;
+						}
+						spaceAvailable.notify_one();
+						request.client->send(computeResponse(request.line, state));
+						request.client.reset();
+					}
+				}
+
+			public:
+				WorkerPool(u_int threadCount, size_t hashMB) : maxPending(1024 * std::max(1u, threadCount)) {
+					threadCount = std::max(1u, threadCount);
+					for (u_int i = 0; i < threadCount; i++) queues.emplace_back(new Queue());
+					for (u_int i = 0; i < threadCount; i++) workers.emplace_back(&WorkerPool::work, this, i, hashMB);
+				}
+
+				~WorkerPool() {
+					finish();
+				}
+
+				void submit(Request request) {  // from any thread
+					request.client->expectResult();
+					size_t target;
+					{
+						std::unique_lock<std::mutex> lock(waitMutex);
+						spaceAvailable.wait(lock, [this]() { return pending < maxPending; });
+						pending++;
+						target = next++ % queues.size();
+					}
+					{
+						std::lock_guard<std::mutex> lock(queues[target]->mutex);
+						queues[target]->requests.push_back(std::move(request));
+					}
+					workAvailable.notify_one();
+				}
+
+				void finish() {  // answers what is queued, then stops the workers
+					{
+						std::lock_guard<std::mutex> lock(waitMutex);
+						closing = true;
+					}
+					workAvailable.notify_all();
+					for (std::thread& worker : workers) worker.join();
+					workers.clear();
+				}
+		};
+
+		void serveStream(std::istream& in, std::ostream& out, WorkerPool& pool) {  // until the end of the input
+			std::shared_ptr<Client> client = std::make_shared<Client>(out);
+			std::string line;
+			while (std::getline(in, line)) {
+				if (!line.empty() && line.back() == '\r') line.pop_back();
+				if (line.find_first_not_of(" \t") != std::string::npos) pool.submit({ line, client });
+			}
+			pool.finish();
+		}
+
+#ifndef _WIN32
+		// every connection gets its own results, all of them share the workers, runs until the process is stopped
+		void serveSocket(const std::string& path, WorkerPool& pool) {
+			sockaddr_un address = {};
+			if (path.size() >= sizeof(address.sun_path)) throw "socket path too long";
+			address.sun_family = AF_UNIX;
+			std::strcpy(address.sun_path, path.c_str());
+			const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (server < 0) throw "cannot create socket";
+			unlink(path.c_str());  // left over by a previous run
+			if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(server, 64) < 0) {
+				close(server);
+				throw "cannot listen on socket";
+			}
+			while (true) {
+				const int fd = accept(server, nullptr, nullptr);
+				if (fd < 0) continue;
+				std::thread([fd, &pool]() {
+					std::shared_ptr<Client> client = std::make_shared<Client>(fd);
+					std::string pending;
+					char chunk[1 << 16];
+					ssize_t n;
+					while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+						pending.append(chunk, n);
+						size_t begin = 0;
+						for (size_t end; (end = pending.find('\n', begin)) != std::string::npos; begin = end + 1) {
+							std::string line = pending.substr(begin, end - begin);
+							if (!line.empty() && line.back() == '\r') line.pop_back();
+							if (line.find_first_not_of(" \t") != std::string::npos) pool.submit({ line, client });
+						}
+						pending.erase(0, begin);
+					}
+					if (pending.find_first_not_of(" \t\r") != std::string::npos) pool.submit({ pending, client });
+				}).detach();
+			}
+		}
+#endif
+	}
+
+	namespace cli {
+
+		std::string joinArgs(const std::vector<std::string>& args, size_t first) {
+			std::string s;
+			for (size_t i = first; i < args.size(); i++) s += (i == first ? "" : " ") + args[i];
+			return s;
+		}
+
+		// chess perft <depth> [threads] [fen]
+		// chess divide <depth> [threads] [fen]
+		// chess perftsuite [threads] [max depth]
+		// chess search <depth> [hash MB] [threads] [fen]
+		// chess smpbench [depth] [hash MB] [max threads]
+		// chess parsefile <fen or epd file> [threads]
+		// chess canonical <fen>
+		// chess tbgen <max men> <directory> [threads] [signature]
+		// chess tbprobe <directory> <fen>
+		// chess tbverify <directory> [threads] [signature]
+		// chess stats <text or json> <command> [arguments]  (built with -DCHESS_STATS)
+		// chess eval <fen>
+		// chess nnue <network file> <command> [arguments]
+		// chess nnuegen <network file>
+		// chess pack <fen or epd file> <packed file> [threads]
+		// chess unpack <packed file> [max positions]
+		// chess pgn <pgn file> [packed file or -] [threads]
+		// chess batch [threads] [hash MB per thread] [socket path]  (json lines on stdin, or on a local socket, see batch)
+		// chess uci  (same as no arguments)
+		int runCommand(const std::vector<std::string>& args) {
+			const std::string& command = args[0];
+			if (command == "nnue") {  // runs the command with the network as evaluation
+				if (args.size() < 3) throw "missing network file or command";
+				nnue::load(args[1]);
+				std::cout << "network " << args[1] << " | kernels " << nnue::kernels::active.name << std::endl;
+				return runCommand(std::vector<std::string>(args.begin() + 2, args.end()));
+			}
+			if (command == "uci") {
+				return uci::loop(std::cin, std::cout);
+			}
+			if (command == "batch") {
+				u_int threadCount = args.size() > 1 ? std::stoi(args[1]) : std::thread::hardware_concurrency();
+				batch::WorkerPool pool(threadCount, args.size() > 2 ? std::stoi(args[2]) : 16);
+#ifndef _WIN32
+				if (args.size() > 3) batch::serveSocket(args[3], pool);
+#else
+				if (args.size() > 3) throw "no socket on this system";
+#endif
+				batch::serveStream(std::cin, std::cout, pool);
+				return 0;
+			}
+			if (command == "nnuegen") {
+				if (args.size() < 2) throw "missing network file";
+				nnue::save(nnue::computeMaterialNetwork(), args[1]);
+				return 0;
+			}
+			if (command == "eval") {
+				if (args.size() < 2) throw "missing fen";
+				std::cout << evaluation::evaluate(convert::computePositionFromFen(joinArgs(args, 1))) << std::endl;
+				return 0;
+			}
+			if (command == "stats") {  // runs the command, then prints the counters of every thread
+				if (args.size() < 3) throw "missing format or command";
+				if (!stats::ENABLED) throw "counters are compiled out, build with -DCHESS_STATS";
+				if (args[1] != "text" && args[1] != "json") throw "unknown stats format";
+				stats::reset();
+				int result = runCommand(std::vector<std::string>(args.begin() + 2, args.end()));
+				stats::Snapshot snapshot = stats::collect();
+				std::cout << (args[1] == "json" ? stats::computeStatsToJson(snapshot) : stats::computeStatsToText(snapshot));
+				return result;
+			}
+			if (command == "perft" || command == "divide") {
+				if (args.size() < 2) throw "missing depth";
+				int8_t depth = std::stoi(args[1]);
+				u_int threadCount = args.size() > 2 ? std::stoi(args[2]) : std::thread::hardware_concurrency();
+				Position pos = convert::computePositionFromFen(args.size() > 3 ? joinArgs(args, 3) : START_FEN);
+				auto begin = std::chrono::high_resolution_clock::now();
+				uint64_t nodes = 0;
+				if (command == "divide") {
+					for (auto& p : perft::divide(pos, depth, threadCount)) {
+						std::cout << convert::computeMoveToString(p.first) << ": " << p.second << std::endl;
+						nodes += p.second;
+					}
+				} else {
+					nodes = perft::perft(pos, depth, threadCount);
+				}
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+				std::cout << "Nodes: " << nodes << " | Time: " << ms << "ms | NPS: " << nodes * 1000 / (ms + 1) << std::endl;
+				return 0;
+			}
+			if (command == "perftsuite") {
+				u_int threadCount = args.size() > 1 ? std::stoi(args[1]) : std::thread::hardware_concurrency();
+				int8_t maxDepth = args.size() > 2 ? std::stoi(args[2]) : 64;
+				return perft::runSuite(threadCount, maxDepth) ? 0 : 1;
+			}
+			if (command == "search") {
+				if (args.size() < 2) throw "missing depth";
+				search::SearchLimits limits;
+				limits.depth = std::stoi(args[1]);
+				search::TranspositionTable tt(args.size() > 2 ? std::stoi(args[2]) : 16);
+				u_int threadCount = args.size() > 3 ? std::stoi(args[3]) : 1;
+				Position pos = convert::computePositionFromFen(args.size() > 4 ? joinArgs(args, 4) : START_FEN);
+				search::SearchResult result = search::search(pos, limits, tt, threadCount, search::printInfo);
+				for (size_t i = 0; i < result.threadNodes.size(); i++) std::cout << "thread " << i << " nodes " << result.threadNodes[i] << std::endl;
+				std::cout << "pawn table probes " << result.pawnProbes << " hits " << result.pawnHits
+					<< " (" << (result.pawnProbes ? 100 * result.pawnHits / result.pawnProbes : 0) << "%)" << std::endl;
+				std::cout << "bestmove " << convert::computeMoveToString(result.bestMove) << std::endl;
+				return 0;
+			}
+			if (command == "smpbench") {
+				int8_t depth = args.size() > 1 ? std::stoi(args[1]) : 12;
+				size_t hashMB = args.size() > 2 ? std::stoi(args[2]) : 256;
+				u_int maxThreads = args.size() > 3 ? std::stoi(args[3]) : 16;
+				search::runSmpBenchmark(depth, hashMB, maxThreads);
+				return 0;
+			}
+			if (command == "canonical") {
+				if (args.size() < 2) throw "missing fen";
+				Position pos = convert::computePositionFromFen(joinArgs(args, 1));
+				symmetry::CanonicalForm form = symmetry::computeCanonicalForm(pos);
+				std::cout << symmetry::canonicalize(pos).computeFen() << " | symmetry " << form.symmetry << " of " << symmetry::computeValidSymmetryCount(pos) << " | key " << std::hex << form.key << std::dec << std::endl;
+				return 0;
+			}
+			if (command == "tbgen") {
+				if (args.size() < 3) throw "missing max men or directory";
+				u_int maxMen = std::stoi(args[1]);
+				if (maxMen > tablebase::MAX_MEN) throw "too many men for a tablebase";
+				u_int threadCount = args.size() > 3 ? std::stoi(args[3]) : std::thread::hardware_concurrency();
+				tablebase::generateAll(maxMen, args[2], threadCount, args.size() > 4 ? args[4] : "");
+				return 0;
+			}
+			if (command == "tbverify") {  // exits with 1 if a table disagrees with its own moves
+				if (args.size() < 2) throw "missing directory";
+				u_int threadCount = args.size() > 2 ? std::stoi(args[2]) : std::thread::hardware_concurrency();
+				tablebase::tablebases.open(args[1]);
+				bool consistent = true;
+				for (const tablebase::Signature& sig : tablebase::tablebases.getSignatures()) {
+					if (args.size() > 3 && args[3] != sig.name) continue;
+					auto begin = std::chrono::high_resolution_clock::now();
+					uint64_t mismatches = tablebase::verify(sig, tablebase::tablebases, threadCount);
+					auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+					std::cout << (mismatches ? "FAIL   " : "OK     ") << sig.name << " | mismatches " << mismatches << " | Time: " << ms << "ms" << std::endl;
+					consistent = consistent && !mismatches;
+				}
+				return consistent ? 0 : 1;
+			}
+			if (command == "tbprobe") {
+				if (args.size() < 3) throw "missing directory or fen";
+				std::cout << "tables: " << tablebase::tablebases.open(args[1]) << std::endl;
+				Position pos = convert::computePositionFromFen(joinArgs(args, 2));
+				auto toString = [](const tablebase::ProbeResult& r) {
+					return r.wdl == tablebase::draw ? std::string("draw") : (r.wdl == tablebase::win ? "win in " : "loss in ") + std::to_string(r.dtm) + " plies";
+				};
+				tablebase::ProbeResult result;
+				if (!tablebase::tablebases.probe(pos, result)) throw "no table for this position";
+				std::cout << toString(result) << std::endl;
+				MoveList moves;
+				pos.computeLegalMoves(moves);
+				for (Move move : moves) {
+					UndoInfo undo = pos.makeMove(move);
+					if (tablebase::tablebases.probe(pos, result)) std::cout << convert::computeMoveToString(move) << ": " << toString(result) << std::endl;
+					pos.unmakeMove(move, undo);
+				}
+				return 0;
+			}
+			if (command == "pack") {  // positions keep the order of the file
+				if (args.size() < 3) throw "missing fen file or packed file";
+				u_int threadCount = args.size() > 3 ? std::stoi(args[3]) : std::thread::hardware_concurrency();
+				std::vector<std::vector<packed::PackedPosition>> chunks(std::max(threadCount, 1u));
+				auto begin = std::chrono::high_resolution_clock::now();
+				convert::FenFileStats stats = convert::parseFenFile(args[1], threadCount, [&](const convert::FenFields& fields, u_int threadId) {
+					chunks[threadId].push_back(packed::pack(fields));
+				});
+				packed::PackedFileWriter writer(args[2]);
+				for (auto& chunk : chunks) writer.write(chunk.data(), chunk.size());
+				writer.finish();
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+				std::cout << "Positions: " << stats.positions << " | Errors: " << stats.errors << " | Bytes: " << packed::HEADER_SIZE + stats.positions * sizeof(packed::PackedPosition)
+					<< " | Time: " << ms << "ms" << std::endl;
+				return 0;
+			}
+			if (command == "unpack") {
+				if (args.size() < 2) throw "missing packed file";
+				packed::PackedFile file(args[1]);
+				size_t count = args.size() > 2 ? std::min<size_t>(std::stoull(args[2]), file.size()) : file.size();
+				for (size_t i = 0; i < count; i++) std::cout << convert::computeFenFromPosition(packed::unpack(file[i])) << "\n";
+				std::cout << std::flush;
+				return 0;
+			}
+			if (command == "pgn") {  // replays every game, the positions go to the packed file if there is one
+				if (args.size() < 2) throw "missing pgn file";
+				u_int threadCount = args.size() > 3 ? std::stoi(args[3]) : std::thread::hardware_concurrency();
+				auto begin = std::chrono::high_resolution_clock::now();
+				pgn::PgnFileStats stats = args.size() > 2 && args[2] != "-" ? pgn::convertPgnToPacked(args[1], args[2], threadCount)
+					: pgn::parsePgnFile(args[1], threadCount, nullptr);
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+				std::cout << "Games: " << stats.games << " | Positions: " << stats.positions << " | Errors: " << stats.errors << " | Time: " << ms
+					<< "ms | Games/s: " << stats.games * 1000 / (ms + 1) << " | Games/s per thread: " << stats.games * 1000 / (ms + 1) / std::max(threadCount, 1u) << std::endl;
+				return 0;
+			}
+			if (command == "parsefile") {
+				if (args.size() < 2) throw "missing file";
+				u_int threadCount = args.size() > 2 ? std::stoi(args[2]) : std::thread::hardware_concurrency();
+				auto begin = std::chrono::high_resolution_clock::now();
+				convert::FenFileStats stats = convert::parseFenFile(args[1], threadCount, nullptr);
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin).count();
+				std::cout << "Positions: " << stats.positions << " | Errors: " << stats.errors << " | Time: " << ms << "ms | Positions/s: " << stats.positions * 1000 / (ms + 1) << std::endl;
+				return 0;
+			}
+			throw "unknown command";
+		}
+	}
+
+}
+
+
+#ifndef CHESS_NO_MAIN  // defined by programs that include this file, like the benchmark
+int run(int argc, char const *argv[]) {
+	if (argc > 1) return chess::cli::runCommand(std::vector<std::string>(argv + 1, argv + argc));
+	return chess::uci::loop(std::cin, std::cout);  // no arguments: a gui drives the engine
 }
 
 int main(int argc, char const *argv[]) {
 	try {
 		auto begin = std::chrono::high_resolution_clock::now();
-		run(argc, argv);
+		int status = run(argc, argv);
 		auto end = std::chrono::high_resolution_clock::now();
-		std::cout << std::chrono::duration_cast<std::chrono::nanoseconds>(end-begin).count() << "ns" << std::endl;
+		// uci and batch write protocol output only, like the run without arguments
+		const bool timed = argc > 1 && std::string(argv[1]) != "batch" && std::string(argv[1]) != "uci";
+		if (timed) std::cout << std::chrono::duration_cast<std::chrono::nanoseconds>(end-begin).count() << "ns" << std::endl;
+		return status;
 	} catch (const char* s) {
 		std::cerr << "ERROR: " << s << std::endl;
+		return 1;
+	} catch (const std::exception& e) {  // bad numbers in the arguments
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
 	}
-	return 0;
 }
+#endif
 